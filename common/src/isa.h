@@ -0,0 +1,180 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <cstdint>
+
+// The instruction set and binary layout shared by the compiler and the VM.
+namespace isa {
+
+enum reg : uint8_t {
+    zero = 0,
+    v0,
+    v1,
+    a0,
+    a1,
+    a2,
+    a3,
+    a4,
+    a5,
+    temp,
+    s0,
+    s1,
+    s2,
+    s3,
+    s4,
+    s5,
+    s6,
+    s7,
+    s8,
+    s9,
+    s10,
+    s11,
+    s12,
+    s13,
+    s14,
+    s15,
+    s16,
+    s17,
+    s18,
+    s19,
+    sp,
+    lr,
+};
+
+static_assert(reg::lr == 31);
+static constexpr unsigned register_count = 32;
+
+// Registers a function has to preserve for its caller. Calls may overwrite any other.
+[[nodiscard]] constexpr bool callee_saved(reg r) { return (r >= s0 and r <= s19) or r == sp; }
+
+// What an r_type instruction computes, rd = rs1 op rs2. Division and remainder are signed and
+// fault on a zero divisor, shifts use the low five bits of rs2 and shift right arithmetically,
+// comparisons are signed and give 0 or 1.
+enum class r_type_func_num : uint8_t {
+    add = 0,
+    sub = 1,
+    mul = 2,
+    div = 3,
+    rem = 4,
+    bit_and = 5,
+    bit_or = 6,
+    bit_xor = 7,
+    bit_nor = 8,
+    shift_left = 9,
+    shift_right = 10,
+    less = 11,
+    less_eq = 12,
+    equal = 13,
+    not_equal = 14,
+};
+
+enum class opcode : uint8_t {
+    r_type = 0,
+    lui = 1,
+    // Branches when rd equals rs1. The immediate is a signed count of instructions from the
+    // one after the branch.
+    beq = 4,
+    ori = 5,
+    lw = 12,
+    sw = 13,
+    jal = 20,
+    jr = 21,
+    syscall = 63,
+};
+
+static constexpr unsigned opcode_count = 64;
+
+[[nodiscard]] constexpr const char * opcode_name(opcode op) {
+    switch (op) {
+    case opcode::r_type:
+        return "r_type";
+    case opcode::lui:
+        return "lui";
+    case opcode::beq:
+        return "beq";
+    case opcode::ori:
+        return "ori";
+    case opcode::lw:
+        return "lw";
+    case opcode::sw:
+        return "sw";
+    case opcode::jal:
+        return "jal";
+    case opcode::jr:
+        return "jr";
+    case opcode::syscall:
+        return "syscall";
+    }
+    return "unknown";
+}
+
+enum class syscall_func : uint8_t {
+    exit = 0,
+    print = 1,
+    flush = 2,
+};
+
+// Bit positions of the fields in an encoded instruction word
+static constexpr unsigned opcode_shift = 26;
+static constexpr unsigned rd_shift = 21;
+static constexpr unsigned rs1_shift = 16;
+static constexpr unsigned rs2_shift = 11;
+static constexpr unsigned rs3_shift = 6;
+static constexpr unsigned shamt_shift = 6;
+
+static constexpr uint32_t reg_mask = 0x1F;
+static constexpr uint32_t func_mask = 0x3F;
+static constexpr uint32_t imm_mask = 0xFFFF;
+// J-type immediates hold a word address
+static constexpr uint32_t jump_mask = 0x1F'FFFF;
+
+[[nodiscard]] constexpr opcode decode_opcode(uint32_t word) {
+    return static_cast<opcode>(word >> opcode_shift);
+}
+[[nodiscard]] constexpr reg decode_rd(uint32_t word) {
+    return static_cast<reg>((word >> rd_shift) & reg_mask);
+}
+[[nodiscard]] constexpr reg decode_rs1(uint32_t word) {
+    return static_cast<reg>((word >> rs1_shift) & reg_mask);
+}
+[[nodiscard]] constexpr reg decode_rs2(uint32_t word) {
+    return static_cast<reg>((word >> rs2_shift) & reg_mask);
+}
+[[nodiscard]] constexpr reg decode_rs3(uint32_t word) {
+    return static_cast<reg>((word >> rs3_shift) & reg_mask);
+}
+[[nodiscard]] constexpr uint8_t decode_func(uint32_t word) {
+    return static_cast<uint8_t>(word & func_mask);
+}
+[[nodiscard]] constexpr uint16_t decode_imm(uint32_t word) {
+    return static_cast<uint16_t>(word & imm_mask);
+}
+[[nodiscard]] constexpr uint32_t decode_jump_target(uint32_t word) {
+    return (word & jump_mask) << 2;
+}
+
+// Binary layout:
+//  - magic_bytes
+//  - exec_start, sp_start and the segment table length in bytes, each one word
+//  - the segment table: per segment its file offset, length, vm address and NUL padded name
+//  - the segment data
+// The symbol table segment isn't loaded. For each function it holds the function's address,
+// then its name packed like a segment name.
+// Words are written in host byte order. Data words hold their bytes most significant first.
+static constexpr uint8_t magic_bytes[]{0xEF, 0x12, 0x34, 0x56, 0x78, 0x9A,
+                                       0xBC, 0xDE, 1,    0,    0,    0};
+static_assert(sizeof(magic_bytes) == 12);
+
+static constexpr uint32_t header_size = sizeof(magic_bytes) + sizeof(uint32_t) * 3;
+
+// Where the compiler puts the data, then the text unless the data runs past it, and the stack
+// that grows down from sp_start
+static constexpr uint32_t data_start = 0x4000;
+static constexpr uint32_t text_start = 0x5000;
+static constexpr uint32_t sp_start = 0x3000'0000;
+
+static constexpr char symbol_table_segment[] = ".symtab";
+
+} // namespace isa
+
+#endif
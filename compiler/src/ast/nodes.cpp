@@ -2,10 +2,21 @@
 
 #include "ir/ir.h"
 
+#include <cstdlib>
+#include <iostream>
+
 namespace ast {
 
 using ir::operand;
 
+namespace {
+// Language features the compiler can't build yet
+[[noreturn]] void unsupported(const std::string & what) {
+    std::cout << what << " is not supported yet" << std::endl;
+    exit(2);
+}
+} // namespace
+
 // Top level declarations
 module_and_file modul::open_module(const char * path) {
     return {std::make_unique<modul>(modul{path}), fopen(path, "r")};
@@ -29,31 +40,52 @@ void struct_decl::build(ir::modul & mod) const { mod.register_struct(id, fields)
 
 // Expressions
 
-operand binary_expr::compile(ir::modul &) const { return {}; }
+operand binary_expr::compile(ir::modul & mod) const {
+    if (op == binary_operation::boolean_and or op == binary_operation::boolean_or)
+        return mod.compile_short_circuit(op, *lhs, *rhs);
+    auto lhs_value = lhs->compile(mod);
+    return mod.compile_binary_op(op, std::move(lhs_value), rhs->compile(mod));
+}
 
-operand if_expr::compile(ir::modul &) const { return {}; }
+operand if_expr::compile(ir::modul & mod) const {
+    return mod.compile_if_expr(*cond, *true_case, *false_case);
+}
 
 operand literal::compile(ir::modul & mod) const { return mod.compile_literal(value, typ); }
 
-operand lvalue::compile(ir::modul &) const { return {}; }
+operand lvalue::compile(ir::modul & mod) const {
+    if (parent != nullptr) unsupported("Reading struct field " + id);
+    return mod.compile_variable(id);
+}
 
-operand struct_init::compile(ir::modul &) const { return {}; }
+void lvalue::assign(ir::modul & mod, assignment_operation op, operand value) const {
+    if (parent != nullptr) unsupported("Assigning struct field " + id);
+    mod.assign_variable(id, op, std::move(value));
+}
 
-operand unary_expr::compile(ir::modul &) const { return {}; }
+operand struct_init::compile(ir::modul &) const { unsupported("Creating a " + type); }
+
+operand unary_expr::compile(ir::modul & mod) const {
+    return mod.compile_unary_op(op, expr->compile(mod));
+}
 
 // Statements
 
-void assignment::build(ir::modul &) const {}
+void assignment::build(ir::modul & mod) const { dest->assign(mod, op, expr->compile(mod)); }
 
 void block_stmt::build(ir::modul & mod) const {
     for (auto & stmt : stmts) stmt->build(mod);
 }
 
-void for_stmt::build(ir::modul &) const {}
+void for_stmt::build(ir::modul & mod) const {
+    mod.compile_for(*initial, *condition, *increment, *body);
+}
 
 void function_call::build(ir::modul & mod) const { mod.call_function(id, compile_args(mod)); }
 
-operand function_call::compile(ir::modul &) const { return {}; }
+operand function_call::compile(ir::modul &) const {
+    unsupported("Using the result of calling " + id);
+}
 
 std::vector<operand> function_call::compile_args(ir::modul & mod) const {
     std::vector<operand> compiled_args;
@@ -62,12 +94,16 @@ std::vector<operand> function_call::compile_args(ir::modul & mod) const {
     return compiled_args;
 }
 
-void if_stmt::build(ir::modul &) const {}
+void if_stmt::build(ir::modul & mod) const { mod.compile_if(*cond, *then_block, else_block.get()); }
 
-void let_stmt::build(ir::modul &) const {}
+void let_stmt::build(ir::modul & mod) const {
+    mod.define_variable(id, opt_type, expr->compile(mod));
+}
 
-void return_stmt::build(ir::modul &) const {}
+void return_stmt::build(ir::modul & mod) const {
+    mod.compile_return(expr != nullptr ? std::optional{expr->compile(mod)} : std::nullopt);
+}
 
-void while_stmt::build(ir::modul &) const {}
+void while_stmt::build(ir::modul & mod) const { mod.compile_while(*cond, *body); }
 
 } // namespace ast
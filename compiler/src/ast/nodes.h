@@ -205,6 +205,9 @@ class lvalue final : public expression {
 
     ir::operand compile(ir::modul &) const final;
 
+    // Stores value, combined with the current value unless op is a plain assign
+    void assign(ir::modul &, assignment_operation op, ir::operand value) const;
+
   private:
     std::string id;
     std::unique_ptr<lvalue> parent;
@@ -0,0 +1,123 @@
+#include "layout_profile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+
+namespace bytecode {
+
+namespace {
+// The value of "key": in an object, without its quotes when it is a string
+std::optional<std::string> field(const std::string & object, const std::string & key) {
+    auto start = object.find('"' + key + "\":");
+    if (start == std::string::npos) return std::nullopt;
+    start = object.find_first_not_of(' ', start + key.size() + 3);
+    if (start == std::string::npos) return std::nullopt;
+
+    if (object[start] == '"') {
+        auto end = object.find('"', start + 1);
+        if (end == std::string::npos) return std::nullopt;
+        return object.substr(start + 1, end - start - 1);
+    }
+    auto end = object.find_first_of(",}", start);
+    return object.substr(start, end - start);
+}
+
+// A call count, which may have whitespace after it. Nothing when it isn't a number that fits.
+std::optional<uint64_t> count_value(const std::string & text) {
+    uint64_t value = 0;
+    const auto * end = text.data() + text.size();
+    auto [rest, error] = std::from_chars(text.data(), end, value);
+    if (error != std::errc{} or rest == text.data()) return std::nullopt;
+    if (std::any_of(rest, end, [](char c) { return c != ' ' and c != '\n' and c != '\t'; }))
+        return std::nullopt;
+    return value;
+}
+} // namespace
+
+std::optional<layout_profile> read_layout_profile(const std::string & path) {
+    std::ifstream input{path};
+    if (not input) return std::nullopt;
+    const std::string json{std::istreambuf_iterator<char>{input}, {}};
+
+    // Functions and edges are the only objects with nothing nested in them
+    layout_profile profile;
+    for (auto open = json.find('{'); open != std::string::npos; open = json.find('{', open + 1)) {
+        auto close = json.find_first_of("{}", open + 1);
+        if (close == std::string::npos or json[close] != '}') continue;
+        const auto object = json.substr(open, close - open + 1);
+
+        auto calls = field(object, "calls");
+        if (not calls.has_value()) continue;
+        const auto count = count_value(*calls);
+        if (not count.has_value()) {
+            std::cout << "Layout profile " << path << " has a bad call count: " << *calls
+                      << std::endl;
+            return std::nullopt;
+        }
+        if (auto name = field(object, "name")) {
+            profile.calls[*name] += *count;
+        } else if (auto caller = field(object, "caller"), callee = field(object, "callee");
+                   caller.has_value() and callee.has_value()) {
+            profile.edges[{*caller, *callee}] += *count;
+        }
+    }
+    return profile;
+}
+
+std::vector<std::string> hot_order(const layout_profile & profile,
+                                   const std::vector<std::string> & declared) {
+    auto calls_of = [&profile](const std::string & name) -> uint64_t {
+        auto iter = profile.calls.find(name);
+        return iter == profile.calls.end() ? 0 : iter->second;
+    };
+
+    // Every function that ran starts as a chain of its own. Going from the heaviest edge down,
+    // the caller's chain and the callee's chain are joined, so each pair lands as close as the
+    // earlier joins allow.
+    std::vector<std::vector<std::string>> chains;
+    std::map<std::string, size_t> chain_of;
+    for (auto & name : declared) {
+        if (calls_of(name) == 0) continue;
+        chain_of.emplace(name, chains.size());
+        chains.push_back({name});
+    }
+
+    std::vector<std::pair<std::pair<std::string, std::string>, uint64_t>> edges{
+        profile.edges.begin(), profile.edges.end()};
+    std::stable_sort(edges.begin(), edges.end(),
+                     [](const auto & lhs, const auto & rhs) { return lhs.second > rhs.second; });
+    for (auto & [edge, calls] : edges) {
+        auto caller = chain_of.find(edge.first);
+        auto callee = chain_of.find(edge.second);
+        if (caller == chain_of.end() or callee == chain_of.end()) continue;
+        const auto into = caller->second;
+        const auto from = callee->second;
+        if (into == from) continue;
+
+        for (auto & name : chains[from]) chain_of[name] = into;
+        std::move(chains[from].begin(), chains[from].end(), std::back_inserter(chains[into]));
+        chains[from].clear();
+    }
+
+    auto heat = [&calls_of](const std::vector<std::string> & chain) {
+        return std::accumulate(chain.begin(), chain.end(), uint64_t{0},
+                               [&calls_of](uint64_t sum, auto & name) {
+                                   return sum + calls_of(name);
+                               });
+    };
+    std::stable_sort(chains.begin(), chains.end(),
+                     [&heat](const auto & lhs, const auto & rhs) { return heat(lhs) > heat(rhs); });
+
+    std::vector<std::string> order;
+    order.reserve(declared.size());
+    for (auto & chain : chains) order.insert(order.end(), chain.begin(), chain.end());
+    for (auto & name : declared)
+        if (calls_of(name) == 0) order.push_back(name);
+    return order;
+}
+
+} // namespace bytecode
@@ -0,0 +1,35 @@
+#ifndef LAYOUT_PROFILE_H
+#define LAYOUT_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bytecode {
+
+// Call counts from running a program with arturo_vm --profile
+struct layout_profile {
+    // Times each function was called, by name
+    std::map<std::string, uint64_t> calls;
+    // Times each caller called each callee, by their names
+    std::map<std::pair<std::string, std::string>, uint64_t> edges;
+
+    [[nodiscard]] bool empty() const noexcept { return calls.empty(); }
+};
+
+// Reads the JSON the VM writes, or nothing when the file can't be read or a call count is
+// malformed
+[[nodiscard]] std::optional<layout_profile> read_layout_profile(const std::string & path);
+
+// Orders the functions, given in declaration order, so the callers and callees that call each
+// other most are next to each other, hottest first. Functions that never ran go last, in
+// declaration order.
+[[nodiscard]] std::vector<std::string> hot_order(const layout_profile &,
+                                                 const std::vector<std::string> & declared);
+
+} // namespace bytecode
+
+#endif
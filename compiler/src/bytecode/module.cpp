@@ -2,146 +2,563 @@
 
 #include "ast/nodes.h"
 #include "ir/ir.h"
+#include "ir/literals.h"
 #include "ir/type.h"
 
 #include <algorithm>
 #include <cassert>
-#include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <numeric>
 
 namespace bytecode {
 
-modul::modul(ir::modul && mod)
-    : ir_modul{std::make_unique<ir::modul>(std::move(mod))} {}
+namespace {
+uint32_t parse_integer(const std::string & text) {
+    auto value = ir::integer_value(text);
+    if (not value.has_value()) {
+        std::cout << "Integer literal " << text << " does not fit in 32 bits" << std::endl;
+        exit(5);
+    }
+    return *value;
+}
+
+// Whether the instruction at index is a call with nothing but the return after it, right away
+// or in the block it then jumps to. main exits instead of returning, so it never makes one.
+bool is_tail_call(const std::string & function, const ir::modul::function_details & func,
+                  const linear_code & layout, size_t index) {
+    const auto & code = layout.instructions;
+    if (function == "main" or code[index]->op != ir::operation::call or index + 1 == code.size())
+        return false;
+    const auto & next = *code[index + 1];
+    return next.op == ir::operation::ret
+        or (next.op == ir::operation::jump
+            and func.blocks[next.targets.front()].instructions.front().op == ir::operation::ret);
+}
+
+// Registers the call at position may overwrite that hold values needed after it
+std::set<isa::reg> caller_saved_live(const register_allocation & allocation, uint32_t position) {
+    auto live = allocation.live_across(position);
+    for (auto iter = live.begin(); iter != live.end();)
+        iter = isa::callee_saved(*iter) ? live.erase(iter) : std::next(iter);
+    return live;
+}
+
+// Packs name most significant byte first, NUL terminated and padded to a whole word
+void pack_name(const std::string & name, std::vector<uint32_t> & output) {
+    uint32_t packed = 0;
+    for (auto i = 0u; i <= name.size(); ++i) {
+        packed = packed << 8 | (i < name.size() ? static_cast<uint8_t>(name[i]) : 0u);
+        if (i % 4 == 3) {
+            output.push_back(packed);
+            packed = 0;
+        }
+    }
+    if (auto remaining = (name.size() + 1) % 4; remaining != 0)
+        output.push_back(packed << (8 * (4 - remaining)));
+}
+} // namespace
+
+modul::modul(ir::modul && mod, const peephole_options & peephole, layout_profile profile)
+    : ir_modul{std::make_unique<ir::modul>(std::move(mod))}
+    , peephole_opts{peephole}
+    , profile{std::move(profile)} {}
 
 void modul::build() {
-    for (auto & iter : ir_modul->compiled_functions()) {
-        std::cout << "Building " << iter.first << '\n';
-        auto [func_iter, inserted] = [this, &iter] {
-            std::map<ir::operand, reg> param_regs;
-            uint8_t param_reg = reg::a0;
-            for (auto & param : iter.second.parameters) {
-                param_regs.emplace(param, static_cast<reg>(param_reg++));
-                assert(param_reg <= reg::a5);
-            }
-            return functions.emplace(
-                iter.first, function_details{{}, std::move(param_regs), iter.second.number});
-        }();
+    // There is no instruction for a phi, they become copies in the blocks before
+    ir_modul->lower_phis();
+    // String addresses are fixed before allocation, so their cost is known
+    intern_strings();
+
+    std::vector<std::pair<uint32_t, const std::string *>> by_number;
+    for (auto & iter : ir_modul->compiled_functions())
+        by_number.emplace_back(iter.second.number, &iter.first);
+    std::sort(by_number.begin(), by_number.end());
+
+    // Allocate every function first, so calls can find any of them
+    functions.reserve(by_number.size());
+    for (auto & [number, name_ptr] : by_number) {
+        const auto & name = *name_ptr;
+        const auto & func = ir_modul->compiled_functions().at(name);
+        auto layout = lay_out(func);
+        register_allocation allocation{
+            func, layout, [this, &func](const ir::operand & operand) {
+                return constant_cost(func, operand);
+            }};
+        size_t most_saved = 0;
+        auto makes_calls = false;
+        const auto & code = layout.instructions;
+        for (auto i = 0u; i < code.size(); ++i) {
+            if (code[i]->op != ir::operation::call) continue;
+            // A tail call jumps without linking, and nothing is needed after it
+            if (is_tail_call(name, func, layout, i)) continue;
+            most_saved = std::max(most_saved, caller_saved_live(allocation, i + 1).size());
+            makes_calls = true;
+        }
+        auto frame_size = allocation.spill_bytes() + static_cast<uint32_t>(most_saved * 4);
+
+        // main exits instead of returning, so it has nothing to preserve
+        std::vector<reg> callee_saved;
+        std::optional<uint32_t> link_offset;
+        if (name != "main") {
+            for (auto reg : allocation.used_registers())
+                if (isa::callee_saved(reg)) callee_saved.push_back(reg);
+            if (makes_calls)
+                link_offset = frame_size + static_cast<uint32_t>(callee_saved.size() * 4);
+        }
+        const auto callee_saved_offset = frame_size;
+        frame_size += static_cast<uint32_t>(callee_saved.size() * 4);
+        if (link_offset.has_value()) frame_size += 4;
+        const auto moves_sp = makes_calls and frame_size != 0;
+
+        auto [iter, inserted]
+            = function_indices.emplace(name, static_cast<uint32_t>(functions.size()));
         assert(inserted);
-        current_function = iter.first;
-        for (auto & instruction : iter.second.instructions) compile_to_ir(instruction);
-        current_function.clear();
+        functions.push_back({name,
+                             &func,
+                             std::move(layout),
+                             {},
+                             {},
+                             std::move(allocation),
+                             frame_size,
+                             std::move(callee_saved),
+                             callee_saved_offset,
+                             link_offset,
+                             moves_sp});
+    }
+
+    for (auto index = 0u; index < functions.size(); ++index) {
+        const auto & name = functions[index].name;
+        const auto & func = *functions[index].source;
+        std::cout << "Building " << name << '\n';
+        current_function = index;
+        prologue(func);
+        const auto & layout = functions[index].layout;
+        for (auto block = 0u; block < layout.blocks.size(); ++block) {
+            functions[index].block_starts.push_back(
+                static_cast<uint32_t>(functions[index].instructions.size()));
+            for (auto i = layout.block_starts[block]; i < layout.block_starts[block + 1]; ++i) {
+                for (auto & [constant, reg] : cur_func().allocation.constants_before(i + 1))
+                    load_constant(reg, value_for(func, constant));
+                const auto tail = is_tail_call(name, func, layout, i);
+                compile_to_ir(*layout.instructions[i], i + 1, block + 1, tail);
+                // The callee returns for us, so the return or jump after is left out
+                if (tail) ++i;
+            }
+        }
+        if (auto removed = peephole(functions[index]); removed != 0 and peephole_opts.stats)
+            std::cout << "Peephole removed " << removed << " instructions from " << name << '\n';
+        resolve_branches();
+        current_function.reset();
     }
 }
 
-// TODO: Allow inserting directly into a predefined register
-modul::reg modul::register_for(const ir::operand & operand) {
+void modul::prologue(const ir::modul::function_details & func) {
+    if (cur_func().moves_sp) move_sp(r_type_func_num::sub);
+    if (auto link_offset = cur_func().link_offset)
+        add_instruction(opcode::sw, i_type{reg::lr, isa::sp, stack_offset(*link_offset)});
+    auto offset = cur_func().callee_saved_offset;
+    for (auto reg : cur_func().callee_saved) {
+        add_instruction(opcode::sw, i_type{reg, isa::sp, stack_offset(offset)});
+        offset += 4;
+    }
 
-    if (auto iter = cur_func().allocated_registers.find(operand);
-        iter != cur_func().allocated_registers.end()) {
-        return iter->second;
+    for (auto i = 0u; i < func.parameters.size(); ++i) {
+        auto arg_reg = static_cast<reg>(reg::a0 + i);
+        auto loc = cur_func().allocation.location_of(func.parameters[i]);
+        if (not loc.has_value()) continue;
+
+        if (auto * in_reg = std::get_if<reg>(&*loc)) {
+            if (*in_reg != arg_reg) add_instruction(opcode::ori, i_type{*in_reg, arg_reg, 0});
+        } else {
+            auto offset = stack_offset(std::get<spill_slot>(*loc).offset);
+            add_instruction(opcode::sw, i_type{arg_reg, isa::sp, offset});
+        }
     }
+}
 
-    if (operand.typ == ir::string_type::instance) {
-        // TODO: This only works for raw strings
-        auto addr = add_string_to_data(operand.name);
-        assert(addr <= UINT16_MAX);
-        add_instruction(opcode::ori, i_type{reg::temp, reg::zero, static_cast<uint16_t>(addr)});
-        return reg::temp;
+void modul::epilogue(std::optional<uint32_t> tail_callee) {
+    auto offset = cur_func().callee_saved_offset;
+    for (auto reg : cur_func().callee_saved) {
+        add_instruction(opcode::lw, i_type{reg, isa::sp, stack_offset(offset)});
+        offset += 4;
     }
+    if (auto link_offset = cur_func().link_offset)
+        add_instruction(opcode::lw, i_type{reg::lr, isa::sp, stack_offset(*link_offset)});
+    if (cur_func().moves_sp) move_sp(r_type_func_num::add);
+    if (tail_callee.has_value())
+        add_instruction(opcode::jal, j_type{reg::zero, *tail_callee});
+    else
+        add_instruction(opcode::jr, j_type{reg::lr, 0});
+}
+
+void modul::move_sp(r_type_func_num direction) {
+    // There is no immediate add, the frame size goes through temp
+    const auto size = cur_func().frame_size;
+    assert(size <= UINT16_MAX);
+    add_instruction(opcode::ori, i_type{reg::temp, reg::zero, static_cast<uint16_t>(size)});
+    add_instruction(opcode::r_type, r_type{isa::sp, isa::sp, reg::temp, 0, direction});
+}
 
-    if (operand.typ == ir::integer_type::instance) {
-        assert(isdigit(operand.name.front()));
-        auto value = std::stoi(operand.name);
+// TODO: Allow inserting directly into a predefined register
+modul::reg modul::register_for(const ir::operand & operand, reg scratch) {
+
+    if (auto loc = cur_func().allocation.location_of(operand)) {
+        if (auto * in_reg = std::get_if<reg>(&*loc)) return *in_reg;
+        assert(scratch != reg::zero);
+        auto offset = stack_offset(std::get<spill_slot>(*loc).offset);
+        add_instruction(opcode::lw, i_type{scratch, isa::sp, offset});
+        return scratch;
+    }
+
+    if (operand.typ == ir::string_type::instance or operand.typ == ir::integer_type::instance
+        or operand.typ == ir::boolean_type::instance) {
+        auto value = value_for(*cur_func().source, operand);
         if (value == 0) return reg::zero;
-        assert(value < UINT16_MAX);
-        add_instruction(opcode::ori, i_type{reg::temp, reg::zero, static_cast<uint16_t>(value)});
-        return reg::temp;
+        assert(scratch != reg::zero);
+        load_constant(scratch, value);
+        return scratch;
     }
 
     std::cout << "Could not make bytecode for type " << *operand.typ << std::endl;
     exit(5);
 }
 
-uint32_t modul::value_for(const ir::operand & operand) {
+uint32_t modul::value_for(const ir::modul::function_details & func, const ir::operand & operand) {
+    assert(func.kind_of(operand) == ir::value_kind::literal);
 
     if (operand.typ == ir::string_type::instance) {
         // TODO: This only works for raw strings
-        auto addr = add_string_to_data(operand.name);
-        assert(addr <= UINT16_MAX);
-        return addr;
+        return intern_string(func.text_of(operand));
     }
 
-    if (operand.typ == ir::integer_type::instance) {
-        assert(isdigit(operand.name.front()));
-        auto value = std::stoi(operand.name);
-        assert(value < UINT16_MAX);
-        return value;
-    }
+    if (operand.typ == ir::integer_type::instance) return parse_integer(func.text_of(operand));
+
+    if (operand.typ == ir::boolean_type::instance) return func.text_of(operand) == "true" ? 1 : 0;
 
     std::cout << "Could not make value for type " << *operand.typ << std::endl;
     exit(5);
 }
 
-uint32_t modul::add_string_to_data(const std::string & text) {
-    auto addr = vm_data_start + data_segment.size();
+uint32_t modul::constant_cost(const ir::modul::function_details & func,
+                              const ir::operand & operand) {
+    if (operand.typ != ir::string_type::instance and operand.typ != ir::integer_type::instance
+        and operand.typ != ir::boolean_type::instance)
+        return 0;
+
+    auto value = value_for(func, operand);
+    if (value == 0) return 0;
+    return value <= UINT16_MAX or (value & UINT16_MAX) == 0 ? 1 : 2;
+}
+
+void modul::load_constant(reg dest, uint32_t value) {
+    // ori zero extends its immediate, lui loads the upper half and clears the lower one
+    if (value <= UINT16_MAX) {
+        add_instruction(opcode::ori, i_type{dest, reg::zero, static_cast<uint16_t>(value)});
+        return;
+    }
+    add_instruction(opcode::lui, i_type{dest, reg::zero, static_cast<uint16_t>(value >> 16)});
+    if (auto low = static_cast<uint16_t>(value & UINT16_MAX); low != 0)
+        add_instruction(opcode::ori, i_type{dest, dest, low});
+}
+
+void modul::intern_strings() {
+    std::set<std::string> literals;
+    for (auto & [name, func] : ir_modul->compiled_functions()) {
+        // Parameters and results may be strings too, only literals go in the data
+        for (auto & block : func.blocks)
+            for (auto & inst : block.instructions)
+                for (auto & arg : inst.args)
+                    if (arg.typ == ir::string_type::instance
+                        and func.kind_of(arg) == ir::value_kind::literal)
+                        literals.insert(func.text_of(arg));
+    }
+
+    // A suffix of a string is a prefix of it reversed. Sorting the reversed texts in descending
+    // order puts each one right after a longer one it is a prefix of, when there is such a one.
+    std::vector<std::string> reversed;
+    reversed.reserve(literals.size());
+    for (auto & text : literals) reversed.emplace_back(text.rbegin(), text.rend());
+    std::sort(reversed.begin(), reversed.end(), std::greater<>{});
+
+    const std::string * stored = nullptr;
+    uint32_t stored_addr = 0;
+    for (auto & rev : reversed) {
+        std::string text{rev.rbegin(), rev.rend()};
+        if (stored != nullptr and stored->compare(0, rev.size(), rev) == 0) {
+            // Both end with the same NUL
+            auto addr = stored_addr + static_cast<uint32_t>(stored->size() - rev.size());
+            interned_strings.emplace(std::move(text), addr);
+            continue;
+        }
+        stored = &rev;
+        stored_addr = intern_string(text);
+    }
+}
+
+uint32_t modul::intern_string(const std::string & text) {
+    if (auto iter = interned_strings.find(text); iter != interned_strings.end())
+        return iter->second;
+
+    auto addr = isa::data_start + data_segment.size();
+    assert(addr <= UINT32_MAX);
     for (char c : text) data_segment.push_back(c);
     data_segment.push_back(0);
-    assert(addr <= UINT32_MAX);
+    interned_strings.emplace(text, static_cast<uint32_t>(addr));
     return static_cast<uint32_t>(addr);
 }
 
-void modul::compile_to_ir(const ir::instruction & inst) {
+modul::reg modul::result_register(const ir::operand & result, reg scratch) {
+    auto loc = cur_func().allocation.location_of(result);
+    if (auto * in_reg = loc.has_value() ? std::get_if<reg>(&*loc) : nullptr) return *in_reg;
+    return scratch;
+}
+
+void modul::store_result(const ir::operand & result, reg value) {
+    auto loc = cur_func().allocation.location_of(result);
+    if (auto * slot = loc.has_value() ? std::get_if<spill_slot>(&*loc) : nullptr)
+        add_instruction(opcode::sw, i_type{value, isa::sp, stack_offset(slot->offset)});
+}
+
+void modul::branch_to(reg lhs, reg rhs, uint32_t block) {
+    add_instruction(opcode::beq, i_type{lhs, rhs, 0});
+    // Blocks aren't placed yet, resolve_branches makes this an offset
+    functions[*current_function].instructions.back().imm = block;
+}
+
+void modul::jump_to(uint32_t block, uint32_t next_block) {
+    if (block != next_block) branch_to(reg::zero, reg::zero, block);
+}
+
+void modul::resolve_branches() {
+    auto & func = functions[*current_function];
+    for (auto i = 0u; i < func.instructions.size(); ++i) {
+        auto & inst = func.instructions[i];
+        if (inst.op != opcode::beq) continue;
+        auto offset = int64_t{func.block_starts[inst.imm]} - (int64_t{i} + 1);
+        if (offset < INT16_MIN or offset > INT16_MAX) {
+            std::cout << "Cannot branch " << offset << " instructions in " << func.name
+                      << std::endl;
+            exit(5);
+        }
+        inst.imm = static_cast<uint16_t>(offset);
+    }
+}
+
+void modul::compile_binary_op(const ir::instruction & inst) {
+    const auto & lhs = inst.args[0];
+    const auto & rhs = inst.args[1];
+    if (lhs.typ != ir::integer_type::instance and lhs.typ != ir::boolean_type::instance) {
+        std::cout << "Cannot compile ir op #" << (unsigned)inst.op << " on " << *lhs.typ
+                  << " to bytecode." << std::endl;
+        exit(5);
+    }
+
+    // Greater is less with the operands the other way around, booleans are 0 or 1
+    auto swapped = false;
+    r_type_func_num func;
+    switch (inst.op) {
+    case ir::operation::add:
+        func = r_type_func_num::add;
+        break;
+    case ir::operation::sub:
+        func = r_type_func_num::sub;
+        break;
+    case ir::operation::mul:
+        func = r_type_func_num::mul;
+        break;
+    case ir::operation::div:
+        func = r_type_func_num::div;
+        break;
+    case ir::operation::rem:
+        func = r_type_func_num::rem;
+        break;
+    case ir::operation::bit_and:
+        func = r_type_func_num::bit_and;
+        break;
+    case ir::operation::bit_or:
+        func = r_type_func_num::bit_or;
+        break;
+    case ir::operation::bit_xor:
+        func = r_type_func_num::bit_xor;
+        break;
+    case ir::operation::bit_left:
+        func = r_type_func_num::shift_left;
+        break;
+    case ir::operation::bit_right:
+        func = r_type_func_num::shift_right;
+        break;
+    case ir::operation::less_eq:
+        func = r_type_func_num::less_eq;
+        break;
+    case ir::operation::less:
+        func = r_type_func_num::less;
+        break;
+    case ir::operation::greater_eq:
+        func = r_type_func_num::less_eq;
+        swapped = true;
+        break;
+    case ir::operation::greater:
+        func = r_type_func_num::less;
+        swapped = true;
+        break;
+    case ir::operation::equal:
+        func = r_type_func_num::equal;
+        break;
+    case ir::operation::not_equal:
+        func = r_type_func_num::not_equal;
+        break;
+    default:
+        assert(false);
+        return;
+    }
+
+    // Each operand that isn't in a register needs a scratch register of its own
+    auto first = register_for(swapped ? rhs : lhs, reg::temp);
+    auto second = register_for(swapped ? lhs : rhs, reg::v1);
+    auto dest = result_register(*inst.result);
+    add_instruction(opcode::r_type, r_type{dest, first, second, 0, func});
+    store_result(*inst.result, dest);
+}
+
+void modul::compile_unary_op(const ir::instruction & inst) {
+    const auto & value = inst.args.front();
+    if (value.typ != ir::integer_type::instance and value.typ != ir::boolean_type::instance) {
+        std::cout << "Cannot compile ir op #" << (unsigned)inst.op << " on " << *value.typ
+                  << " to bytecode." << std::endl;
+        exit(5);
+    }
+
+    auto source = register_for(value);
+    auto dest = result_register(*inst.result);
+    switch (inst.op) {
+    case ir::operation::boolean_not:
+        add_instruction(opcode::r_type, r_type{dest, source, reg::zero, 0, r_type_func_num::equal});
+        break;
+    case ir::operation::negation:
+        add_instruction(opcode::r_type, r_type{dest, reg::zero, source, 0, r_type_func_num::sub});
+        break;
+    case ir::operation::bit_not:
+        add_instruction(opcode::r_type,
+                        r_type{dest, source, reg::zero, 0, r_type_func_num::bit_nor});
+        break;
+    default:
+        assert(false);
+    }
+    store_result(*inst.result, dest);
+}
+
+void modul::compile_to_ir(const ir::instruction & inst, uint32_t position, uint32_t next_block,
+                          bool tail_call) {
     switch (inst.op) {
     case ir::operation::call: {
-        auto used_regs = used_registers();
-        // Push regs onto stack
-        uint16_t stack_used = 0;
-        // TODO: S registers are caller saved.
-        // This will involve creating a predule and conclusion.
-        for (auto & reg : used_regs) {
-            add_instruction(opcode::sw, i_type{reg, sp, stack_used});
-            stack_used += 4;
+        // The callee preserves s registers, only the rest still needed afterwards are saved.
+        // Nothing is needed after a tail call.
+        auto saved = tail_call ? std::set<reg>{}
+                               : caller_saved_live(cur_func().allocation, position);
+        auto save_offset = cur_func().allocation.spill_bytes();
+        for (auto reg : saved) {
+            add_instruction(opcode::sw, i_type{reg, isa::sp, stack_offset(save_offset)});
+            save_offset += 4;
         }
-        // Copy args to arg regs
+        // Copy args to arg regs, loading them straight there when they aren't in a register
         assert(inst.args.size() >= 1);
         for (auto i = 1u; i < inst.args.size(); ++i) {
             auto arg_reg = static_cast<reg>(reg::a0 + i - 1);
             assert(arg_reg <= reg::a5);
-            auto src_reg = register_for(inst.args[i]);
-            add_instruction(opcode::ori, i_type{arg_reg, src_reg, 0});
+            auto src_reg = register_for(inst.args[i], arg_reg);
+            if (src_reg != arg_reg) add_instruction(opcode::ori, i_type{arg_reg, src_reg, 0});
         }
         // jal to do the call
-        auto iter = ir_modul->compiled_functions().find(inst.args.front().name);
-        assert(iter != ir_modul->compiled_functions().end());
-        add_instruction(opcode::jal, j_type{reg::lr, iter->second.number});
+        auto callee = function_indices.at(cur_func().source->text_of(inst.args.front()));
+        if (tail_call) {
+            epilogue(callee);
+            break;
+        }
+        add_instruction(opcode::jal, j_type{reg::lr, callee});
         // TODO: save the result from V registers
 
-        // Pop stack
-        for (auto & reg : used_regs) {
-            stack_used -= 4;
-            add_instruction(opcode::lw, i_type{reg, sp, stack_used});
+        // Restore the saved registers
+        for (auto reg = saved.rbegin(); reg != saved.rend(); ++reg) {
+            save_offset -= 4;
+            add_instruction(opcode::lw, i_type{*reg, isa::sp, stack_offset(save_offset)});
         }
-        assert(stack_used == 0);
     } break;
     case ir::operation::syscall: {
         assert(inst.args.size() == 5);
-        auto func = value_for(inst.args[4]);
+        auto func = value_for(*cur_func().source, inst.args[4]);
         assert(func < (1u << 7));
+        // Every operand that isn't in a register needs a scratch register of its own
+        static constexpr reg scratch[]{reg::temp, reg::v0, reg::v1};
+        auto scratch_used = 0u;
+        auto operand_reg = [this, &scratch_used](const ir::operand & operand) {
+            auto next = scratch_used < std::size(scratch) ? scratch[scratch_used] : reg::zero;
+            auto result = register_for(operand, next);
+            if (result == next and next != reg::zero) ++scratch_used;
+            return result;
+        };
         add_instruction(opcode::syscall, s_type{
-                                             .rd = register_for(inst.args[0]),
-                                             .rs1 = register_for(inst.args[1]),
-                                             .rs2 = register_for(inst.args[2]),
-                                             .rs3 = register_for(inst.args[3]),
+                                             .rd = operand_reg(inst.args[0]),
+                                             .rs1 = operand_reg(inst.args[1]),
+                                             .rs2 = operand_reg(inst.args[2]),
+                                             .rs3 = operand_reg(inst.args[3]),
                                              .func = static_cast<uint8_t>(func),
                                          });
     } break;
+    case ir::operation::add:
+    case ir::operation::sub:
+    case ir::operation::mul:
+    case ir::operation::div:
+    case ir::operation::rem:
+    case ir::operation::less_eq:
+    case ir::operation::less:
+    case ir::operation::greater_eq:
+    case ir::operation::greater:
+    case ir::operation::equal:
+    case ir::operation::not_equal:
+    case ir::operation::bit_and:
+    case ir::operation::bit_or:
+    case ir::operation::bit_xor:
+    case ir::operation::bit_left:
+    case ir::operation::bit_right:
+        compile_binary_op(inst);
+        break;
+    case ir::operation::boolean_not:
+    case ir::operation::negation:
+    case ir::operation::bit_not:
+        compile_unary_op(inst);
+        break;
+    case ir::operation::assign: {
+        auto dest = result_register(*inst.result);
+        // Loaded or built straight into the result's register
+        auto source = register_for(inst.args.front(), dest);
+        if (source != dest) add_instruction(opcode::ori, i_type{dest, source, 0});
+        store_result(*inst.result, dest);
+    } break;
+    case ir::operation::branch: {
+        // beq to the false block when the condition is 0, otherwise on to the true block
+        const auto & laid_out_at = cur_func().layout.laid_out_at;
+        branch_to(register_for(inst.args.front()), reg::zero, laid_out_at[inst.targets[1]]);
+        jump_to(laid_out_at[inst.targets[0]], next_block);
+    } break;
+    case ir::operation::jump:
+        jump_to(cur_func().layout.laid_out_at[inst.targets.front()], next_block);
+        break;
     case ir::operation::ret: {
-        assert(inst.args.empty());
-        add_instruction(opcode::jr, j_type{reg::lr, 0});
+        // TODO: Return the value in v0
+        assert(inst.args.size() <= 1);
+        // Returning from main ends the program
+        if (cur_func().name == "main") {
+            add_instruction(opcode::syscall,
+                            s_type{reg::zero, reg::zero, reg::zero, reg::zero,
+                                   static_cast<uint8_t>(isa::syscall_func::exit)});
+            break;
+        }
+        epilogue();
     } break;
     default:
         std::cout << "Cannot compile ir op #" << (unsigned)inst.op << " to bytecode." << std::endl;
@@ -149,210 +566,223 @@ void modul::compile_to_ir(const ir::instruction & inst) {
     }
 }
 
-void modul::add_instruction(opcode op, std::variant<r_type, i_type, j_type, s_type> && data) {
-
-    auto iter = functions.find(current_function);
-    assert(iter != functions.end());
-
-    iter->second.instructions.emplace_back(op, std::move(data));
-}
-
-modul::reg modul::alloc_reg() {
-    auto candidate = static_cast<reg>(s0 + random() % (s19 - s0 + 1));
-    auto used_regs = used_registers();
-    while (used_regs.count(candidate) != 0)
-        candidate = static_cast<reg>(s0 + random() % (s19 - s0 + 1));
-    return candidate;
-}
-
 void modul::write(const std::string & output_name) {
     if (functions.empty()) build();
 
+    const auto binary = layout_binary();
     auto * output = fopen(output_name.c_str(), "w");
-
-    static constexpr uint8_t magic_bytes[]{0xEF, 0x12, 0x34, 0x56, 0x78, 0x9A,
-                                           0xBC, 0xDE, 1,    0,    0,    0};
-    static_assert(sizeof(magic_bytes) == 12);
-    // primary header
-    if (fwrite(magic_bytes, 1, sizeof(magic_bytes), output) != sizeof(magic_bytes)) {
-        std::cout << "Error occured writing out binary." << std::endl;
-        exit(10);
-    }
-
-    auto prog_data = layout_segments(sizeof(magic_bytes) + sizeof(uint32_t) * 3);
-    if (fwrite(&prog_data.exec_start, sizeof(prog_data.exec_start), 1, output) != 1) {
+    auto written = output != nullptr
+               and fwrite(binary.data(), sizeof(binary.front()), binary.size(), output)
+                       == binary.size();
+    if (output != nullptr and fclose(output) != 0) written = false;
+    if (not written) {
         std::cout << "Error occured writing out binary." << std::endl;
         exit(10);
     }
+}
 
-    static_assert(sizeof(sp_start) == 4);
-    if (fwrite(&sp_start, sizeof(sp_start), 1, output) != 1) {
-        std::cout << "Error occured writing out binary." << std::endl;
-        exit(10);
-    }
-    // segment table
-    static constexpr auto segment_table_item_size = sizeof(prog_data.segment_table.front());
-    assert(prog_data.segment_table.size() < UINT32_MAX / segment_table_item_size);
-    uint32_t segment_table_byte_len
-        = static_cast<uint32_t>(prog_data.segment_table.size() * segment_table_item_size);
-    static_assert(sizeof(segment_table_byte_len) == 4);
-
-    if (fwrite(&segment_table_byte_len, sizeof(segment_table_byte_len), 1, output) != 1) {
-        std::cout << "Error occured writing out binary." << std::endl;
-        exit(10);
-    }
+std::vector<uint32_t> modul::layout_binary() {
+    static constexpr uint32_t word = sizeof(uint32_t);
+    // Names are NUL terminated and padded to a whole word
+    auto name_bytes = [](const std::string & name) {
+        return static_cast<uint32_t>((name.size() + word) / word * word);
+    };
 
-    if (fwrite(prog_data.segment_table.data(), segment_table_item_size,
-               prog_data.segment_table.size(), output)
-        != prog_data.segment_table.size()) {
-        std::cout << "Error occured writing out binary." << std::endl;
-        exit(10);
+    while (data_segment.size() % 4 != 0) data_segment.push_back(0);
+    assert(data_segment.size() < UINT32_MAX);
+    const auto data_bytes = static_cast<uint32_t>(data_segment.size());
+
+    // Large data pushes the text up to the next page after it
+    static constexpr uint32_t page_size = 0x1000;
+    const auto vm_text_addr = std::max(
+        isa::text_start, (isa::data_start + data_bytes + page_size - 1) / page_size * page_size);
+
+    std::vector<uint32_t> order(functions.size());
+    std::iota(order.begin(), order.end(), 0u);
+    if (not profile.empty()) {
+        std::vector<std::string> declared;
+        for (auto & func : functions) declared.push_back(func.name);
+        auto hot = hot_order(profile, declared);
+        std::transform(hot.begin(), hot.end(), order.begin(),
+                       [this](const std::string & name) { return function_indices.at(name); });
     }
 
-    // actual code
-    if (fwrite(prog_data.segment_data.data(), sizeof(prog_data.segment_data.front()),
-               prog_data.segment_data.size(), output)
-        != prog_data.segment_data.size()) {
-        std::cout << "Error occured writing out binary." << std::endl;
-        exit(10);
+    // Callees may come after their callers, so every address is needed before any jal
+    std::vector<uint32_t> func_addrs(functions.size());
+    auto next_addr = vm_text_addr;
+    for (auto index : order) {
+        func_addrs[index] = next_addr;
+        next_addr += static_cast<uint32_t>(functions[index].instructions.size() * word);
     }
+    const auto text_bytes = next_addr - vm_text_addr;
 
-    fclose(output);
-}
-
-modul::program_data modul::layout_segments(uint32_t start_segment_table) {
-    std::vector<uint32_t> segment_table;
-    std::vector<uint32_t> segment_data;
+    // The symbol table lets the VM name functions
+    uint32_t symbol_bytes = 0;
+    for (auto & func : functions) symbol_bytes += word + name_bytes(func.name);
 
     struct segment {
-        uint32_t start_after_table;
         uint32_t length;
         uint32_t vm_addr;
         std::string name;
-
-        uint32_t size() const {
-            auto name_size = name.size() + 1;
-            while (name_size % 4 != 0) ++name_size;
-            return static_cast<uint32_t>(sizeof(uint32_t) * 3 + name_size);
-        }
     };
-    std::vector<segment> segments;
+    const segment segments[]{
+        {data_bytes, isa::data_start, ".data"},
+        {text_bytes, vm_text_addr, ".text"},
+        {symbol_bytes, 0, isa::symbol_table_segment},
+    };
+    uint32_t table_bytes = 0;
+    for (auto & seg : segments) table_bytes += word * 3 + name_bytes(seg.name);
+
+    // Everything is sized now, so the file is built in one go without reallocating
+    const auto total_bytes
+        = isa::header_size + table_bytes + data_bytes + text_bytes + symbol_bytes;
+    std::vector<uint32_t> binary;
+    binary.reserve(total_bytes / word);
+
+    // primary header
+    uint32_t magic[sizeof(isa::magic_bytes) / word];
+    static_assert(sizeof(magic) == sizeof(isa::magic_bytes));
+    memcpy(magic, isa::magic_bytes, sizeof(magic));
+    binary.insert(binary.end(), std::begin(magic), std::end(magic));
+    binary.push_back(func_addrs[function_indices.at("main")]);
+    binary.push_back(isa::sp_start);
+    binary.push_back(table_bytes);
+
+    // segment table, the segments follow it in the same order
+    auto file_offset = isa::header_size + table_bytes;
+    for (auto & seg : segments) {
+        binary.push_back(file_offset);
+        binary.push_back(seg.length);
+        binary.push_back(seg.vm_addr);
+        pack_name(seg.name, binary);
+        file_offset += seg.length;
+    }
 
-    while (data_segment.size() % 4 != 0) data_segment.push_back(0);
-    assert(data_segment.size() < UINT32_MAX);
     // data segment
     for (auto i = 0u; i < data_segment.size(); i += 4)
-        segment_data.push_back(data_segment[i] << (32 - 8) | data_segment[i + 1] << 16
-                               | data_segment[i + 2] << 8 | data_segment[i + 3]);
+        binary.push_back(data_segment[i] << (32 - 8) | data_segment[i + 1] << 16
+                         | data_segment[i + 2] << 8 | data_segment[i + 3]);
 
-    auto text_start = static_cast<uint32_t>(data_segment.size());
-    segments.push_back({0, text_start, vm_data_start, ".data"});
     // text segment
-    std::vector<function_details> funcs;
-    for (auto & iter : functions) funcs.push_back(iter.second);
-    std::sort(funcs.begin(), funcs.end(),
-              [](const function_details & lhs, const function_details & rhs) {
-                  return lhs.number < rhs.number;
-              });
-    const auto main_num = functions.find("main")->second.number;
-
-    std::map<uint32_t, uint32_t> func_addrs;
-    for (auto & func : funcs) {
-        func_addrs.insert({func.number, vm_text_start + segment_data.size() * 4 - text_start});
-
-        for (auto & instruction : func.instructions) {
+    for (auto index : order) {
+        for (auto instruction : functions[index].instructions) {
             // fill in jal info
-            if (instruction.op == opcode::jal) {
-                auto & data = std::get<j_type>(instruction.data);
-                data.imm = func_addrs.find(data.imm)->second;
-            }
-            segment_data.push_back(instruction);
+            if (instruction.op == opcode::jal) instruction.imm = func_addrs[instruction.imm];
+            binary.push_back(instruction);
         }
-        // TODO: Add this earlier in the pipeline
-        if (func.number == main_num)
-            segment_data.push_back(
-                instruction{opcode::syscall, s_type{zero, zero, zero, zero, zero}});
     }
 
-    segments.push_back({text_start, static_cast<uint32_t>(segment_data.size() * 4) - text_start,
-                        vm_text_start, ".text"});
-
-    auto segment_table_total_size
-        = std::accumulate(segments.begin(), segments.end(), 0u,
-                          [](uint32_t sum, const auto & segment) { return sum + segment.size(); });
-    for (auto & segment : segments) {
-        segment_table.push_back(start_segment_table + segment_table_total_size
-                                + segment.start_after_table);
-        segment_table.push_back(segment.length);
-        segment_table.push_back(segment.vm_addr);
-        uint32_t temp = 0;
-        auto i = 0ul;
-        for (; i < segment.name.size(); ++i) {
-            if (i != 0 and i % 4 == 0) {
-                segment_table.push_back(temp);
-                temp = 0;
-            }
-            temp <<= 8;
-            temp |= (i < segment.name.size() ? segment.name.at(i) : 0);
-        }
-        if ((segment.name.size() + 1) % 4 != 0) {
-            while (i % 4 != 0) {
-                temp <<= 8;
-                ++i;
-            }
-            segment_table.push_back(temp);
-        }
+    // symbol table
+    for (auto index = 0u; index < functions.size(); ++index) {
+        binary.push_back(func_addrs[index]);
+        pack_name(functions[index].name, binary);
     }
 
-    return {segment_table, segment_data, func_addrs.find(main_num)->second};
+    assert(binary.size() * word == total_bytes);
+    return binary;
 }
 
 const modul::function_details & modul::cur_func() const {
-    assert(not current_function.empty());
-    auto iter = functions.find(current_function);
-    assert(iter != functions.end());
-    return iter->second;
+    assert(current_function.has_value());
+    return functions[*current_function];
 }
 
-std::set<modul::reg> modul::used_registers() const {
-    std::set<reg> used;
-    for (auto & iter : cur_func().allocated_registers) {
-        // TODO: Use lifetime analysis
-        used.insert(iter.second);
-    }
-    return used;
+uint16_t modul::stack_offset(uint32_t frame_offset) const {
+    // lw and sw sign extend their offset, a frame that stays below sp is reached through that
+    const auto & func = cur_func();
+    assert(func.frame_size <= 0x8000 and frame_offset < func.frame_size);
+    if (func.moves_sp) return static_cast<uint16_t>(frame_offset);
+    return static_cast<uint16_t>(-static_cast<int32_t>(func.frame_size - frame_offset));
 }
 
+modul::instruction::instruction(opcode op, const r_type & data)
+    : op{op}
+    , rd{data.rd}
+    , rs1{data.rs1}
+    , rs2{data.rs2}
+    , imm{static_cast<uint32_t>(data.shamt) << 8 | static_cast<uint8_t>(data.func)} {}
+
+modul::instruction::instruction(opcode op, const i_type & data)
+    : op{op}
+    , rd{data.rd}
+    , rs1{data.rs}
+    , imm{data.imm} {}
+
+modul::instruction::instruction(opcode op, const j_type & data)
+    : op{op}
+    , rd{data.rd}
+    , imm{data.imm} {}
+
+modul::instruction::instruction(opcode op, const s_type & data)
+    : op{op}
+    , rd{data.rd}
+    , rs1{data.rs1}
+    , rs2{data.rs2}
+    , imm{static_cast<uint32_t>(data.rs3) << 8 | data.func} {}
+
 [[nodiscard]] modul::instruction::operator uint32_t() const {
-    // TODO: Name magic numbers
-    uint32_t result = (uint32_t)op << 26;
+    uint32_t result = (uint32_t)op << isa::opcode_shift | rd << isa::rd_shift;
     switch (op) {
-    case opcode::r_type: {
-        auto data = std::get<r_type>(this->data);
-        result |= (data.rd << 21) | (data.rs1 << 16) | (data.rs2 << 11) | (data.shamt << 6)
-                | (uint8_t)data.func;
-    } break;
+    case opcode::r_type:
+        result |= (rs1 << isa::rs1_shift) | (rs2 << isa::rs2_shift)
+                | ((imm >> 8) << isa::shamt_shift) | (imm & 0xFF);
+        break;
         // I-type
     case opcode::lui:
+    case opcode::beq:
     case opcode::ori:
     case opcode::lw:
-    case opcode::sw: {
-        auto data = std::get<i_type>(this->data);
-        result |= (data.rd << 21) | (data.rs << 16) | data.imm;
-    } break;
+    case opcode::sw:
+        result |= (rs1 << isa::rs1_shift) | (imm & 0xFFFF);
+        break;
         // J-type
     case opcode::jal:
-    case opcode::jr: {
-        auto data = std::get<j_type>(this->data);
-        result |= (data.rd << 21) | ((data.imm >> 2) & 0x1F'FFFF);
-    } break;
+    case opcode::jr:
+        result |= (imm >> 2) & isa::jump_mask;
+        break;
         // S-type
-    case opcode::syscall: {
-        auto data = std::get<s_type>(this->data);
-        result
-            |= (data.rd << 21) | (data.rs1 << 16) | (data.rs2 << 11) | (data.rs3 << 6) | data.func;
-    } break;
+    case opcode::syscall:
+        result |= (rs1 << isa::rs1_shift) | (rs2 << isa::rs2_shift)
+                | ((imm >> 8) << isa::rs3_shift) | (imm & 0xFF);
+        break;
     }
     return result;
 }
+
+bool modul::instruction::reads(reg r) const {
+    switch (op) {
+    case opcode::r_type:
+        return rs1 == r or rs2 == r;
+    case opcode::lui:
+    case opcode::jal:
+        return false;
+    case opcode::ori:
+    case opcode::lw:
+        return rs1 == r;
+    case opcode::beq:
+    case opcode::sw:
+    case opcode::jr:
+        return rd == r or rs1 == r;
+    case opcode::syscall:
+        return rd == r or rs1 == r or rs2 == r or static_cast<reg>(imm >> 8) == r;
+    }
+    return false;
+}
+
+std::optional<modul::reg> modul::instruction::writes() const {
+    switch (op) {
+    case opcode::r_type:
+    case opcode::lui:
+    case opcode::ori:
+    case opcode::lw:
+    case opcode::jal:
+        return rd;
+    case opcode::beq:
+    case opcode::sw:
+    case opcode::jr:
+    case opcode::syscall:
+        return std::nullopt;
+    }
+    return std::nullopt;
+}
 } // namespace bytecode
@@ -3,26 +3,45 @@
 
 #include "ast/nodes_forward.h"
 #include "ir/ir_forward.h"
+#include "isa.h"
+#include "layout_profile.h"
 #include "module_forward.h"
+#include "register_allocation.h"
 
+#include <cassert>
 #include <cstdio>
-#include <map>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
-#include <variant>
+#include <unordered_map>
 #include <vector>
 
 namespace bytecode {
 
+// Which rewrites the peephole pass makes on each built function
+struct peephole_options {
+    // Drop moves of a register to itself
+    bool self_moves = true;
+    // Put a value straight in the register it is copied to from a scratch register
+    bool forward_scratch = true;
+    // Replace reloads of a frame slot stored since the last call with moves, then drop stores
+    // nothing reloads
+    bool store_load_pairs = true;
+    // Print how many instructions the rewrites removed from each function
+    bool stats = false;
+
+    [[nodiscard]] static peephole_options none() noexcept { return {false, false, false}; }
+};
+
 class modul final {
 
   public:
     void build();
     void write(const std::string &);
 
-    explicit modul(ir::modul &&);
+    // The functions go in declaration order, unless a profile says which ones are hot
+    explicit modul(ir::modul &&, const peephole_options & = {}, layout_profile = {});
     modul(const modul &) = delete;
     modul & operator=(const modul &) = delete;
 
@@ -31,58 +50,13 @@ class modul final {
 
     ~modul() noexcept = default;
 
-    enum reg : uint8_t {
-        zero = 0,
-        v0,
-        v1,
-        a0,
-        a1,
-        a2,
-        a3,
-        a4,
-        a5,
-        temp,
-        s0,
-        s1,
-        s2,
-        s3,
-        s4,
-        s5,
-        s6,
-        s7,
-        s8,
-        s9,
-        s10,
-        s11,
-        s12,
-        s13,
-        s14,
-        s15,
-        s16,
-        s17,
-        s18,
-        s19,
-        sp,
-        lr,
-    };
-
-    static_assert(reg::lr == 31);
+    using reg = isa::reg;
 
   private:
     std::unique_ptr<ir::modul> ir_modul;
 
-    enum class r_type_func_num : uint8_t {};
-
-    enum class opcode : uint8_t {
-        r_type = 0,
-        lui = 1,
-        ori = 5,
-        lw = 12,
-        sw = 13,
-        jal = 20,
-        jr = 21,
-        syscall = 63,
-    };
+    using r_type_func_num = isa::r_type_func_num;
+    using opcode = isa::opcode;
 
     struct r_type {
         reg rd, rs1, rs2;
@@ -106,50 +80,129 @@ class modul final {
         uint8_t func;
     };
 
-    using instruction_data = std::variant<r_type, i_type, j_type, s_type>;
+    // A pending instruction as a fixed 8 byte record. Fields hold what they do in the encoding:
+    // an i_type's rs is in rs1, a j_type's target is in imm, and r_type and s_type keep their
+    // function in the low byte of imm with shamt or rs3 in the byte above.
     struct instruction {
         opcode op;
-        instruction_data data;
+        reg rd = reg::zero;
+        reg rs1 = reg::zero;
+        reg rs2 = reg::zero;
+        uint32_t imm = 0;
 
-        instruction(opcode op, instruction_data && data)
-            : op{op}
-            , data{std::move(data)} {}
+        instruction(opcode, const r_type &);
+        instruction(opcode, const i_type &);
+        instruction(opcode, const j_type &);
+        instruction(opcode, const s_type &);
 
         [[nodiscard]] operator uint32_t() const;
+
+        [[nodiscard]] bool reads(reg) const;
+        [[nodiscard]] std::optional<reg> writes() const;
     };
+    static_assert(sizeof(instruction) == 8);
 
-    void add_instruction(opcode, instruction_data &&);
-    reg alloc_reg();
+    template<typename format>
+    void add_instruction(opcode op, const format & data) {
+        assert(current_function.has_value());
+        functions[*current_function].instructions.emplace_back(op, data);
+    }
 
-    struct program_data {
-        std::vector<uint32_t> segment_table;
-        std::vector<uint32_t> segment_data;
-        uint32_t exec_start;
-    };
-    program_data layout_segments(uint32_t start_segment_table);
+    // The whole output file. Every part is sized first, then it is built in a single buffer.
+    [[nodiscard]] std::vector<uint32_t> layout_binary();
 
     struct function_details {
+        std::string name;
+        const ir::modul::function_details * source;
+        linear_code layout;
         std::vector<instruction> instructions;
-        std::map<ir::operand, reg> allocated_registers;
-        uint32_t number;
+        // Where each block starts in instructions, by its index in the layout. Until
+        // resolve_branches, a beq's imm is the layout index of the block it goes to.
+        std::vector<uint32_t> block_starts;
+        register_allocation allocation;
+        // The frame holds spill slots, then room for caller saved registers live across a call,
+        // then the s registers the function uses, then lr when the function makes calls.
+        uint32_t frame_size;
+        std::vector<reg> callee_saved;
+        uint32_t callee_saved_offset;
+        std::optional<uint32_t> link_offset;
+        // Whether the prologue moves sp below the frame, so calls put their frames under it.
+        // Without calls other than a tail call, nothing else runs while the function does,
+        // so its frame stays below sp.
+        bool moves_sp;
     };
 
-    void compile_to_ir(const ir::instruction &);
-
-    std::map<std::string, function_details> functions;
-    std::string current_function;
+    // Runs the enabled peephole rewrites over a built function, returning how many
+    // instructions it removed
+    uint32_t peephole(function_details &) const;
+    static void remove_self_moves(std::vector<instruction> &, std::vector<uint32_t> & block_starts);
+    static void forward_scratch(std::vector<instruction> &, std::vector<uint32_t> & block_starts);
+    static void remove_store_load_pairs(std::vector<instruction> &,
+                                        std::vector<uint32_t> & block_starts);
+    // Where the blocks some beq goes to start, the only places reached other than from the
+    // instruction before
+    [[nodiscard]] static std::set<uint32_t>
+    branch_targets(const std::vector<instruction> &, const std::vector<uint32_t> & block_starts);
+    // Drops the instructions marked in removed, moving each block start to the first instruction
+    // of the block that is kept
+    static void erase_marked(std::vector<instruction> &, const std::vector<bool> & removed,
+                             std::vector<uint32_t> & block_starts);
+    // Turns the target block of every beq of the current function into its offset
+    void resolve_branches();
+
+    // Makes room for the frame, saves lr and the s registers the function uses, then moves the
+    // parameters to where they were allocated
+    void prologue(const ir::modul::function_details &);
+    // Restores what the prologue saved and frees the frame, then returns, or jumps to the tail
+    // callee so it returns to our caller instead
+    void epilogue(std::optional<uint32_t> tail_callee = std::nullopt);
+    // Subtracts the frame size from sp to make room for the frame, or adds it to free it
+    void move_sp(r_type_func_num direction);
+    // position is the instruction's position in its function, as used by register_allocation.
+    // A tail call is a call right before the return, which it replaces. next_block is the
+    // layout index of the block after the instruction's, which a jump there falls through to.
+    void compile_to_ir(const ir::instruction &, uint32_t position, uint32_t next_block,
+                       bool tail_call = false);
+    void compile_binary_op(const ir::instruction &);
+    void compile_unary_op(const ir::instruction &);
+    // A beq to the block at layout index block
+    void branch_to(reg lhs, reg rhs, uint32_t block);
+    // Jumps to the block unless it is the next one
+    void jump_to(uint32_t block, uint32_t next_block);
+
+    // In declaration order. Before layout, a jal's target is the callee's index here.
+    std::vector<function_details> functions;
+    std::unordered_map<std::string, uint32_t> function_indices;
+    std::optional<uint32_t> current_function;
 
     [[nodiscard]] const function_details & cur_func() const;
-    [[nodiscard]] std::set<reg> used_registers() const;
+    // The sp relative offset of a byte offset in the current function's frame
+    [[nodiscard]] uint16_t stack_offset(uint32_t frame_offset) const;
+
+    // Returns the register holding operand, loading it into scratch when it isn't in one
+    [[nodiscard]] reg register_for(const ir::operand &, reg scratch = reg::temp);
+    // The register to compute a result in, scratch when the result is spilled
+    [[nodiscard]] reg result_register(const ir::operand &, reg scratch = reg::temp);
+    // Stores a result computed in reg to its spill slot, when it has one
+    void store_result(const ir::operand &, reg);
+    // The value of a literal of func, strings are their address in the data
+    [[nodiscard]] uint32_t value_for(const ir::modul::function_details & func,
+                                     const ir::operand &);
+    [[nodiscard]] uint32_t constant_cost(const ir::modul::function_details & func,
+                                         const ir::operand &);
+    void load_constant(reg, uint32_t value);
+
+    // Stores every string literal of the module once, before anything asks for an address.
+    // A literal ending another one points into it instead of getting its own copy.
+    void intern_strings();
+    // The address of text in the data, adding it when it isn't there yet
+    [[nodiscard]] uint32_t intern_string(const std::string &);
 
-    [[nodiscard]] reg register_for(const ir::operand &);
-    [[nodiscard]] uint32_t value_for(const ir::operand &);
-    [[nodiscard]] uint32_t add_string_to_data(const std::string &);
-
-    static constexpr uint32_t vm_text_start = 0x5000;
-    static constexpr uint32_t vm_data_start = 0x4000;
-    static constexpr uint32_t sp_start = 0x3000'0000;
     std::vector<uint8_t> data_segment;
+    std::unordered_map<std::string, uint32_t> interned_strings;
+
+    peephole_options peephole_opts;
+    layout_profile profile;
 
     uint32_t func_num = 0;
 };
@@ -0,0 +1,148 @@
+#include "module.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace bytecode {
+
+namespace {
+// Registers only ever holding an operand for the instruction right after, they don't survive
+// calls, returns or branches
+[[nodiscard]] constexpr bool scratch(isa::reg reg) {
+    return reg == isa::temp or reg == isa::v0 or reg == isa::v1;
+}
+} // namespace
+
+uint32_t modul::peephole(function_details & func) const {
+    auto & code = func.instructions;
+    const auto before = code.size();
+
+    // Reloads become moves and scratch copies, so those go first
+    if (peephole_opts.store_load_pairs) remove_store_load_pairs(code, func.block_starts);
+    if (peephole_opts.forward_scratch) forward_scratch(code, func.block_starts);
+    if (peephole_opts.self_moves) remove_self_moves(code, func.block_starts);
+
+    assert(code.size() <= before);
+    return static_cast<uint32_t>(before - code.size());
+}
+
+std::set<uint32_t> modul::branch_targets(const std::vector<instruction> & code,
+                                         const std::vector<uint32_t> & block_starts) {
+    std::set<uint32_t> targets;
+    for (auto & inst : code)
+        if (inst.op == opcode::beq) targets.insert(block_starts[inst.imm]);
+    return targets;
+}
+
+void modul::erase_marked(std::vector<instruction> & code, const std::vector<bool> & removed,
+                         std::vector<uint32_t> & block_starts) {
+    // How many instructions are kept before each index
+    std::vector<uint32_t> kept_before(code.size() + 1, 0);
+    for (auto i = 0u; i < code.size(); ++i)
+        kept_before[i + 1] = kept_before[i] + (removed[i] ? 0 : 1);
+    for (auto & start : block_starts) start = kept_before[start];
+
+    auto kept = 0u;
+    for (auto i = 0u; i < code.size(); ++i)
+        if (not removed[i]) code[kept++] = std::move(code[i]);
+    code.erase(code.begin() + kept, code.end());
+}
+
+void modul::remove_self_moves(std::vector<instruction> & code,
+                              std::vector<uint32_t> & block_starts) {
+    std::vector<bool> removed(code.size(), false);
+    for (auto i = 0u; i < code.size(); ++i)
+        removed[i] = code[i].op == opcode::ori and code[i].rd == code[i].rs1 and code[i].imm == 0;
+    erase_marked(code, removed, block_starts);
+}
+
+void modul::forward_scratch(std::vector<instruction> & code,
+                            std::vector<uint32_t> & block_starts) {
+    // Whether the scratch register is read again before it is overwritten
+    auto read_after = [&code](size_t index, reg scratch_reg) {
+        for (auto i = index + 1; i < code.size(); ++i) {
+            if (code[i].reads(scratch_reg)) return true;
+            if (code[i].writes() == scratch_reg or code[i].op == opcode::jal
+                or code[i].op == opcode::jr or code[i].op == opcode::beq)
+                return false;
+        }
+        return false;
+    };
+
+    // A move other code branches to has to stay where it is
+    const auto targets = branch_targets(code, block_starts);
+    std::vector<bool> removed(code.size(), false);
+    std::optional<uint32_t> prev_index;
+    for (auto i = 0u; i < code.size(); ++i) {
+        // ori dest, scratch, 0 right after scratch was set
+        if (code[i].op == opcode::ori and prev_index.has_value() and targets.count(i) == 0) {
+            const auto & move = code[i];
+            auto & prev = code[*prev_index];
+            const auto sets_scratch = prev.op == opcode::ori or prev.op == opcode::lui
+                                   or prev.op == opcode::lw;
+            if (move.imm == 0 and scratch(move.rs1) and move.rd != move.rs1
+                and move.rd != reg::zero and sets_scratch and prev.writes() == move.rs1
+                and not read_after(i, move.rs1)) {
+                prev.rd = move.rd;
+                removed[i] = true;
+                continue;
+            }
+        }
+        prev_index = i;
+    }
+    erase_marked(code, removed, block_starts);
+}
+
+void modul::remove_store_load_pairs(std::vector<instruction> & code,
+                                    std::vector<uint32_t> & block_starts) {
+    auto frame_slot = [](const instruction & inst, opcode op) -> std::optional<uint16_t> {
+        if (inst.op != op or inst.rs1 != isa::sp) return std::nullopt;
+        return static_cast<uint16_t>(inst.imm);
+    };
+
+    const auto targets = branch_targets(code, block_starts);
+    for (auto i = 0u; i < code.size(); ++i) {
+        auto slot = frame_slot(code[i], opcode::lw);
+        if (not slot.has_value()) continue;
+
+        // The closest store to the slot, as long as the stored register still holds the value.
+        // Code that is branched to may have come from elsewhere.
+        for (auto j = i; j-- > 0 and targets.count(j + 1) == 0;) {
+            // Moving sp moves every slot with it
+            if (code[j].op == opcode::jal or code[j].op == opcode::jr
+                or code[j].writes() == isa::sp)
+                break;
+            if (frame_slot(code[j], opcode::sw) != slot) continue;
+
+            const auto stored = code[j].rd;
+            const auto unchanged
+                = std::none_of(code.begin() + j + 1, code.begin() + i,
+                               [stored](const instruction & inst) {
+                                   return inst.writes() == stored;
+                               });
+            if (unchanged) {
+                code[i] = instruction{opcode::ori, i_type{code[i].rd, stored, 0}};
+            }
+            break;
+        }
+    }
+
+    // Frames never overlap, so only this function reads its slots. A loop can run a reload
+    // before the store again, so then any reload counts.
+    auto loops = false;
+    for (auto i = 0u; i < code.size(); ++i)
+        loops = loops or (code[i].op == opcode::beq and block_starts[code[i].imm] <= i);
+    std::vector<bool> removed(code.size(), false);
+    for (auto i = 0u; i < code.size(); ++i) {
+        if (auto slot = frame_slot(code[i], opcode::sw)) {
+            auto reloaded = std::any_of(code.begin() + (loops ? 0 : i + 1), code.end(),
+                                        [&](const instruction & inst) {
+                                            return frame_slot(inst, opcode::lw) == slot;
+                                        });
+            removed[i] = not reloaded;
+        }
+    }
+    erase_marked(code, removed, block_starts);
+}
+
+} // namespace bytecode
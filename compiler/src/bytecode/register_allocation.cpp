@@ -0,0 +1,302 @@
+#include "register_allocation.h"
+
+#include "ir/dominators.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+namespace bytecode {
+
+linear_code lay_out(const ir::modul::function_details & func) {
+    linear_code code;
+    code.blocks = ir::dominator_tree{func}.reverse_postorder();
+    code.laid_out_at.resize(func.blocks.size());
+    for (auto & block : code.blocks) {
+        code.laid_out_at[block] = static_cast<uint32_t>(code.block_starts.size());
+        code.block_starts.push_back(static_cast<uint32_t>(code.instructions.size()));
+        for (auto & inst : func.blocks[block].instructions) code.instructions.push_back(&inst);
+    }
+    code.block_starts.push_back(static_cast<uint32_t>(code.instructions.size()));
+    return code;
+}
+
+std::vector<live_interval> live_intervals(const ir::modul::function_details & func,
+                                          const linear_code & code) {
+    const auto value_count = func.value_count();
+    const auto block_count = code.blocks.size();
+    // Literals and functions are built where they are used, only these get intervals
+    std::vector<bool> defined(value_count, false);
+    for (auto & param : func.parameters) defined[param.id] = true;
+    for (auto * inst : code.instructions)
+        if (inst->result.has_value()) defined[inst->result->id] = true;
+
+    // By layout index, the values each block reads before setting them and the values it sets
+    std::vector<std::vector<bool>> used(block_count, std::vector<bool>(value_count, false));
+    auto set = used;
+    for (auto block = 0u; block < block_count; ++block) {
+        for (auto i = code.block_starts[block]; i < code.block_starts[block + 1]; ++i) {
+            const auto & inst = *code.instructions[i];
+            for (auto & arg : inst.args)
+                if (defined[arg.id] and not set[block][arg.id]) used[block][arg.id] = true;
+            if (inst.result.has_value()) set[block][inst.result->id] = true;
+        }
+    }
+
+    // Values live at the start and end of each block, going backwards until nothing changes
+    auto live_in = used;
+    std::vector<std::vector<bool>> live_out(block_count, std::vector<bool>(value_count, false));
+    for (auto changed = true; changed;) {
+        changed = false;
+        for (auto block = block_count; block-- > 0;) {
+            for (auto successor : func.blocks[code.blocks[block]].successors()) {
+                const auto & successor_in = live_in[code.laid_out_at[successor]];
+                for (auto value = 0u; value < value_count; ++value) {
+                    if (not successor_in[value] or live_out[block][value]) continue;
+                    live_out[block][value] = true;
+                    if (not set[block][value]) live_in[block][value] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<live_interval> intervals;
+    static constexpr auto undefined = SIZE_MAX;
+    std::vector<size_t> interval_of(value_count, undefined);
+    auto live_at = [&intervals, &interval_of](const ir::operand & value, uint32_t position) {
+        if (auto index = interval_of[value.id]; index != undefined) {
+            auto & interval = intervals[index];
+            interval.start = std::min(interval.start, position);
+            interval.end = std::max(interval.end, position);
+            return;
+        }
+        interval_of[value.id] = intervals.size();
+        intervals.push_back({value, position, position});
+    };
+
+    for (auto & param : func.parameters) live_at(param, 0);
+    for (auto block = 0u; block < block_count; ++block) {
+        const auto first = code.block_starts[block];
+        const auto last = code.block_starts[block + 1];
+        for (auto i = first; i < last; ++i) {
+            const auto & inst = *code.instructions[i];
+            for (auto & arg : inst.args)
+                if (defined[arg.id]) live_at(arg, i + 1);
+            if (inst.result.has_value()) live_at(*inst.result, i + 1);
+        }
+        // Live into the block means live at its first instruction, out of it at its last
+        for (auto value = 0u; value < value_count; ++value) {
+            if (live_in[block][value]) live_at(intervals[interval_of[value]].value, first + 1);
+            if (live_out[block][value]) live_at(intervals[interval_of[value]].value, last);
+        }
+    }
+
+    // Parameters start at 0, so they stay at the front in order
+    std::stable_sort(intervals.begin(), intervals.end(),
+                     [](auto & lhs, auto & rhs) { return lhs.start < rhs.start; });
+    return intervals;
+}
+
+namespace {
+// How a constant is used within a function
+struct constant_uses {
+    live_interval interval;
+    // As an operand, which reads the register directly
+    uint32_t direct = 0;
+    // As a call argument, which copies it to an argument register anyway
+    uint32_t copied = 0;
+    // Layout index of the block of the first use
+    uint32_t block = 0;
+    // Whether another block uses it too, which a register built in the first can't serve
+    bool across_blocks = false;
+};
+
+// Every literal of the function, by first use. A constant's interval starts just before its
+// first use, as it is built between that instruction and the one before.
+std::vector<constant_uses> find_constants(const ir::modul::function_details & func,
+                                          const linear_code & code) {
+    std::vector<constant_uses> found;
+    static constexpr auto unused = SIZE_MAX;
+    std::vector<size_t> index_of(func.value_count(), unused);
+    for (auto block = 0u; block < code.blocks.size(); ++block) {
+        for (auto i = code.block_starts[block]; i < code.block_starts[block + 1]; ++i) {
+            const auto position = i + 1;
+            const auto & inst = *code.instructions[i];
+            const auto is_call = inst.op == ir::operation::call;
+            // A syscall's last argument is its function, which goes in the instruction itself
+            const auto end = inst.op == ir::operation::syscall ? inst.args.size() - 1
+                                                                : inst.args.size();
+            for (auto arg = is_call ? 1u : 0u; arg < end; ++arg) {
+                const auto & operand = inst.args[arg];
+                if (func.kind_of(operand) != ir::value_kind::literal) continue;
+                auto & index = index_of[operand.id];
+                if (index == unused) {
+                    index = found.size();
+                    found.push_back({{operand, position - 1, position}, 0, 0, block, false});
+                }
+                auto & uses = found[index];
+                uses.interval.end = position;
+                uses.across_blocks = uses.across_blocks or uses.block != block;
+                ++(is_call ? uses.copied : uses.direct);
+            }
+        }
+    }
+    return found;
+}
+} // namespace
+
+register_allocation::register_allocation(const ir::modul::function_details & func,
+                                         const linear_code & code, const constant_cost & cost)
+    : locations(func.value_count())
+    , constants(func.value_count()) {
+    std::vector<uint32_t> call_positions;
+    for (auto i = 0u; i < code.instructions.size(); ++i)
+        if (code.instructions[i]->op == ir::operation::call) call_positions.push_back(i + 1);
+
+    // Whether a call happens while the value is live, including a call using it last.
+    // Calls overwrite the argument registers, so such values need an s register.
+    auto meets_call = [&call_positions](const live_interval & interval) {
+        return std::any_of(call_positions.begin(), call_positions.end(), [&interval](auto call) {
+            return call > interval.start and call <= interval.end;
+        });
+    };
+
+    auto all = live_intervals(func, code);
+    auto found_constants = find_constants(func, code);
+    std::vector<live_interval> unallocated;
+    std::set<isa::reg> parameter_registers;
+    for (auto i = 0u; i < all.size(); ++i) {
+        auto & interval = all[i];
+        // Unused parameters don't need to live anywhere
+        if (i < func.parameters.size() and interval.end == 0) continue;
+
+        // Parameters stay in their argument register when no call gets in the way
+        if (i >= func.parameters.size() or meets_call(interval)) {
+            unallocated.push_back(std::move(interval));
+            continue;
+        }
+        assert(isa::a0 + i <= isa::a5);
+        auto reg = static_cast<isa::reg>(isa::a0 + i);
+        parameter_registers.insert(reg);
+        locations[interval.value.id] = reg;
+        intervals.push_back(std::move(interval));
+    }
+
+    // Keep a constant in a register when that saves more instructions than it costs, counting
+    // the prologue and epilogue saving an s register
+    for (auto & uses : found_constants) {
+        if (uses.across_blocks) continue;
+        const auto build = cost(uses.interval.value);
+        if (build == 0) continue;
+        const auto saved = uses.direct * build + uses.copied * (build - 1);
+        const auto spent = build + (meets_call(uses.interval) ? 2 : 0);
+        if (saved <= spent) continue;
+        constants[uses.interval.value.id] = uses.interval.start;
+        unallocated.push_back(std::move(uses.interval));
+    }
+    std::stable_sort(unallocated.begin(), unallocated.end(),
+                     [](auto & lhs, auto & rhs) { return lhs.start < rhs.start; });
+
+    allocate(std::move(unallocated), parameter_registers, meets_call);
+}
+
+void register_allocation::allocate(std::vector<live_interval> && unallocated,
+                                   const std::set<isa::reg> & reserved,
+                                   const std::function<bool(const live_interval &)> & meets_call) {
+    std::set<isa::reg> free;
+    for (uint8_t reg = isa::a0; reg <= isa::a5; ++reg) free.insert(static_cast<isa::reg>(reg));
+    for (uint8_t reg = isa::s0; reg <= isa::s19; ++reg) free.insert(static_cast<isa::reg>(reg));
+    for (auto reg : reserved) free.erase(reg);
+
+    // Intervals holding a register, by end
+    std::vector<live_interval> active;
+    auto by_end = [](const live_interval & lhs, const live_interval & rhs) {
+        return lhs.end < rhs.end;
+    };
+    auto reg_of = [this](const live_interval & interval) {
+        return std::get<isa::reg>(locations[interval.value.id].value());
+    };
+
+    for (auto & current : unallocated) {
+        // A value last used by the instruction defining current can share its register
+        while (not active.empty() and active.front().end <= current.start) {
+            free.insert(reg_of(active.front()));
+            active.erase(active.begin());
+        }
+
+        // Argument registers come first, they cost nothing to keep when no call is in the way.
+        // s registers have to be saved by the prologue.
+        const auto needs_saved = meets_call(current);
+        auto usable = [needs_saved](isa::reg reg) {
+            return not needs_saved or isa::callee_saved(reg);
+        };
+
+        std::optional<isa::reg> reg;
+        if (auto candidate = needs_saved ? free.lower_bound(isa::s0) : free.begin();
+            candidate != free.end()) {
+            reg = *candidate;
+            free.erase(candidate);
+        } else if (auto victim = std::find_if(
+                       active.rbegin(), active.rend(),
+                       [&usable, &reg_of](auto & interval) { return usable(reg_of(interval)); });
+                   victim != active.rend() and victim->end > current.end) {
+            // Spill whichever value is next needed furthest away
+            reg = reg_of(*victim);
+            auto & victim_location = locations[victim->value.id];
+            if (constants[victim->value.id].has_value())
+                victim_location.reset();
+            else
+                victim_location = spill();
+            active.erase(std::next(victim).base());
+        }
+
+        if (reg.has_value()) {
+            locations[current.value.id] = *reg;
+            active.insert(std::upper_bound(active.begin(), active.end(), current, by_end), current);
+        } else if (not constants[current.value.id].has_value()) {
+            locations[current.value.id] = spill();
+        }
+        intervals.push_back(std::move(current));
+    }
+}
+
+spill_slot register_allocation::spill() { return {spill_count++ * 4}; }
+
+std::optional<location> register_allocation::location_of(const ir::operand & value) const {
+    return locations[value.id];
+}
+
+std::set<isa::reg> register_allocation::live_across(uint32_t position) const {
+    std::set<isa::reg> live;
+    for (auto & interval : intervals) {
+        if (interval.start >= position or interval.end <= position) continue;
+        const auto & loc = locations[interval.value.id];
+        if (not loc.has_value()) continue;
+        if (auto * reg = std::get_if<isa::reg>(&*loc)) live.insert(*reg);
+    }
+    return live;
+}
+
+std::vector<std::pair<ir::operand, isa::reg>>
+register_allocation::constants_before(uint32_t position) const {
+    std::vector<std::pair<ir::operand, isa::reg>> to_build;
+    for (auto & interval : intervals) {
+        const auto & start = constants[interval.value.id];
+        // Built between the instruction before its first use and that use
+        if (not start.has_value() or *start + 1 != position) continue;
+        if (const auto & loc = locations[interval.value.id])
+            to_build.emplace_back(interval.value, std::get<isa::reg>(*loc));
+    }
+    return to_build;
+}
+
+std::set<isa::reg> register_allocation::used_registers() const {
+    std::set<isa::reg> used;
+    for (auto & loc : locations)
+        if (loc.has_value())
+            if (auto * reg = std::get_if<isa::reg>(&*loc)) used.insert(*reg);
+    return used;
+}
+
+} // namespace bytecode
@@ -0,0 +1,104 @@
+#ifndef REGISTER_ALLOCATION_H
+#define REGISTER_ALLOCATION_H
+
+#include "ir/ir.h"
+#include "isa.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <set>
+#include <variant>
+#include <vector>
+
+namespace bytecode {
+
+// A spilled value's word within its function's frame
+struct spill_slot {
+    // In bytes from the start of the frame
+    uint32_t offset;
+};
+
+using location = std::variant<isa::reg, spill_slot>;
+
+// A function's instructions in the order the backend lays them out, its blocks in reverse
+// postorder so each comes after the blocks dominating it. Instruction i is at position i + 1,
+// parameters are defined at 0.
+struct linear_code {
+    // Block numbers in layout order
+    std::vector<uint32_t> blocks;
+    // Each block's index in blocks, by block number
+    std::vector<uint32_t> laid_out_at;
+    std::vector<const ir::instruction *> instructions;
+    // Where each block in blocks starts in instructions, then where the last one ends
+    std::vector<uint32_t> block_starts;
+};
+
+[[nodiscard]] linear_code lay_out(const ir::modul::function_details &);
+
+// Where a value is live. A value is given a single interval from the first to the last
+// position it is live at, even when it is dead in between.
+struct live_interval {
+    ir::operand value;
+    uint32_t start;
+    // The last position the value is needed at, or start when never used
+    uint32_t end;
+};
+
+// The live interval of every parameter and result of a function, the parameters first in order
+// then the rest by start. Values used on a later trip around a loop stay live through all of it.
+[[nodiscard]] std::vector<live_interval> live_intervals(const ir::modul::function_details &,
+                                                        const linear_code &);
+
+// Instructions needed to build a constant in a register, zero for the zero register
+using constant_cost = std::function<uint32_t(const ir::operand &)>;
+
+// Linear scan register allocation, spilling to the function's frame.
+// Values live at a call get s registers, which the function saves for its callers.
+// Constants used often enough within one block get a register too, built before their first use.
+// They are never spilled, when one loses its register it is rebuilt at every use instead.
+class register_allocation final {
+  public:
+    register_allocation(const ir::modul::function_details &, const linear_code &,
+                        const constant_cost &);
+
+    register_allocation(const register_allocation &) = delete;
+    register_allocation & operator=(const register_allocation &) = delete;
+
+    register_allocation(register_allocation &&) noexcept = default;
+    register_allocation & operator=(register_allocation &&) noexcept = default;
+
+    ~register_allocation() noexcept = default;
+
+    // Where the value lives, or nothing when it isn't a value of this function
+    [[nodiscard]] std::optional<location> location_of(const ir::operand &) const;
+
+    // Registers holding values that are still needed after the instruction at position
+    [[nodiscard]] std::set<isa::reg> live_across(uint32_t position) const;
+
+    // Every register given to a value
+    [[nodiscard]] std::set<isa::reg> used_registers() const;
+
+    // Constants to build before the instruction at position, and where
+    [[nodiscard]] std::vector<std::pair<ir::operand, isa::reg>>
+    constants_before(uint32_t position) const;
+
+    [[nodiscard]] uint32_t spill_bytes() const noexcept { return spill_count * 4; }
+
+  private:
+    // Linear scan over intervals sorted by start, leaving the reserved registers alone
+    void allocate(std::vector<live_interval> &&, const std::set<isa::reg> & reserved,
+                  const std::function<bool(const live_interval &)> & meets_call);
+    [[nodiscard]] spill_slot spill();
+
+    std::vector<live_interval> intervals;
+    // Indexed by value id, nothing for values that don't live anywhere
+    std::vector<std::optional<location>> locations;
+    // Where the interval of each constant that was worth a register starts, by value id
+    std::vector<std::optional<uint32_t>> constants;
+    uint32_t spill_count = 0;
+};
+
+} // namespace bytecode
+
+#endif
@@ -0,0 +1,206 @@
+#include "folding.h"
+#include "ir.h"
+
+#include <algorithm>
+#include <optional>
+#include <set>
+#include <utility>
+
+namespace ir {
+
+namespace {
+// What is known about a value, it only ever moves down from unknown to constant to varying
+struct lattice_value {
+    enum class level : uint8_t { unknown, constant, varying };
+    level state = level::unknown;
+    // The literal, when constant
+    std::string text;
+};
+
+// Instructions are found by block and index
+using position = std::pair<uint32_t, uint32_t>;
+using edge = std::pair<uint32_t, uint32_t>;
+
+struct solver {
+    const modul::function_details & func;
+    std::vector<lattice_value> values;
+    std::vector<std::vector<position>> uses;
+    std::vector<bool> executable_blocks;
+    std::set<edge> executable_edges;
+    std::vector<edge> edge_work;
+    std::vector<value_id> value_work;
+
+    explicit solver(const modul::function_details & func)
+        : func{func}
+        , values(func.value_count())
+        , uses(func.value_count())
+        , executable_blocks(func.blocks.size(), false) {
+        for (auto id = 0u; id < func.value_count(); ++id) {
+            switch (func.values[id].kind) {
+            case value_kind::literal:
+                values[id] = {lattice_value::level::constant, func.values[id].text};
+                break;
+            case value_kind::parameter:
+            case value_kind::function:
+                values[id].state = lattice_value::level::varying;
+                break;
+            case value_kind::temporary:
+                break;
+            }
+        }
+        for (auto block = 0u; block < func.blocks.size(); ++block) {
+            const auto & code = func.blocks[block].instructions;
+            for (auto index = 0u; index < code.size(); ++index)
+                for (auto & arg : code[index].args) uses[arg.id].emplace_back(block, index);
+        }
+    }
+
+    void run() {
+        edge_work.emplace_back(UINT32_MAX, 0);
+        while (not edge_work.empty() or not value_work.empty()) {
+            while (not edge_work.empty()) {
+                auto [from, to] = edge_work.back();
+                edge_work.pop_back();
+                if (not executable_edges.insert({from, to}).second) continue;
+                // A block runs all of its code the first time it is reached, later ways in can
+                // only change its phis
+                const auto first_time = not executable_blocks[to];
+                executable_blocks[to] = true;
+                for (auto & inst : func.blocks[to].instructions)
+                    if (first_time or inst.op == operation::phi) visit(to, inst);
+            }
+            while (not value_work.empty()) {
+                auto id = value_work.back();
+                value_work.pop_back();
+                for (auto [block, index] : uses[id])
+                    if (executable_blocks[block])
+                        visit(block, func.blocks[block].instructions[index]);
+            }
+        }
+    }
+
+    [[nodiscard]] bool executable(uint32_t from, uint32_t to) const {
+        return executable_edges.count({from, to}) != 0;
+    }
+
+  private:
+    void visit(uint32_t block, const instruction & inst) {
+        using level = lattice_value::level;
+        switch (inst.op) {
+        case operation::phi: {
+            lattice_value met;
+            for (auto i = 0u; i < inst.args.size(); ++i) {
+                if (not executable(inst.targets[i], block)) continue;
+                const auto & value = values[inst.args[i].id];
+                if (value.state == level::unknown) continue;
+                if (met.state == level::unknown)
+                    met = value;
+                else if (value.state == level::varying or value.text != met.text)
+                    met.state = level::varying;
+            }
+            lower(*inst.result, std::move(met));
+        } break;
+        case operation::branch: {
+            const auto & cond = values[inst.args.front().id];
+            if (cond.state == level::unknown) break;
+            if (cond.state == level::varying or cond.text == "true")
+                edge_work.emplace_back(block, inst.targets[0]);
+            if (cond.state == level::varying or cond.text == "false")
+                edge_work.emplace_back(block, inst.targets[1]);
+        } break;
+        case operation::jump:
+            edge_work.emplace_back(block, inst.targets.front());
+            break;
+        default: {
+            if (not inst.result.has_value()) break;
+            std::vector<std::string> texts;
+            auto varying = false;
+            for (auto & arg : inst.args) {
+                const auto & value = values[arg.id];
+                if (value.state == level::unknown) return;
+                varying = varying or value.state == level::varying;
+                texts.push_back(value.text);
+            }
+            auto folded = varying ? std::nullopt : fold(inst.op, inst.args.front().typ, texts);
+            lower(*inst.result, folded.has_value() ? lattice_value{level::constant, *folded}
+                                                   : lattice_value{level::varying, {}});
+        }
+        }
+    }
+
+    void lower(const operand & result, lattice_value value) {
+        using level = lattice_value::level;
+        auto & current = values[result.id];
+        // Two different constants mean it varies
+        if (value.state == level::constant and current.state == level::constant
+            and value.text != current.text)
+            value.state = level::varying;
+        if (value.state < current.state) return;
+        if (value.state == current.state
+            and (value.state != level::constant or value.text == current.text))
+            return;
+        current = std::move(value);
+        value_work.push_back(result.id);
+    }
+};
+} // namespace
+
+void modul::propagate_constants(function_details & func) {
+    solver solved{func};
+    solved.run();
+
+    // The literal replacing each temporary found to be constant
+    std::vector<std::optional<operand>> literal_for(func.value_count());
+    for (auto & block : func.blocks) {
+        for (auto & inst : block.instructions) {
+            if (not inst.result.has_value()) continue;
+            const auto & value = solved.values[inst.result->id];
+            if (value.state != lattice_value::level::constant) continue;
+            literal_for[inst.result->id]
+                = func.intern(value_kind::literal, value.text, inst.result->typ);
+        }
+    }
+
+    for (auto index = 0u; index < func.blocks.size(); ++index) {
+        // Unreachable blocks are dropped below
+        if (not solved.executable_blocks[index]) continue;
+        auto & block = func.blocks[index];
+        std::vector<instruction> kept;
+        kept.reserve(block.instructions.size());
+        for (auto & inst : block.instructions) {
+            if (inst.result.has_value() and literal_for[inst.result->id].has_value()) continue;
+
+            if (inst.op == operation::phi) {
+                // Values from ways in that never run don't matter
+                std::vector<operand> args;
+                std::vector<uint32_t> targets;
+                for (auto arg = 0u; arg < inst.args.size(); ++arg) {
+                    if (not solved.executable(inst.targets[arg], index)) continue;
+                    args.push_back(std::move(inst.args[arg]));
+                    targets.push_back(inst.targets[arg]);
+                }
+                inst.args = std::move(args);
+                inst.targets = std::move(targets);
+            } else if (inst.op == operation::branch) {
+                const auto taken_true = solved.executable(index, inst.targets[0]);
+                const auto taken_false = solved.executable(index, inst.targets[1]);
+                if (taken_true != taken_false) {
+                    const auto taken = inst.targets[taken_true ? 0 : 1];
+                    const auto untaken = inst.targets[taken_true ? 1 : 0];
+                    auto & preds = func.blocks[untaken].predecessors;
+                    preds.erase(std::remove(preds.begin(), preds.end(), index), preds.end());
+                    inst = instruction{operation::jump, {}, std::nullopt, {taken}};
+                }
+            }
+            kept.push_back(std::move(inst));
+        }
+        block.instructions = std::move(kept);
+    }
+
+    replace_uses(func, literal_for);
+    remove_unreachable_blocks(func);
+    remove_trivial_phis(func);
+    merge_blocks(func);
+}
+
+} // namespace ir
@@ -0,0 +1,65 @@
+#include "ir.h"
+#include "literals.h"
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace ir {
+
+namespace {
+// Dividing by zero faults the guest, so a division has to stay unless its divisor is a literal
+// that can't be zero. -1 isn't trusted either, as INT32_MIN / -1 doesn't fit.
+bool may_fault(const modul::function_details & func, const instruction & inst) {
+    if (inst.op != operation::div and inst.op != operation::rem) return false;
+    const auto & divisor = inst.args[1];
+    if (func.kind_of(divisor) != value_kind::literal) return true;
+    const auto value = integer_value(func.text_of(divisor));
+    return not value.has_value() or *value == 0 or *value == UINT32_MAX;
+}
+} // namespace
+
+void modul::remove_dead_code(function_details & func) {
+    auto & blocks = func.blocks;
+    // Where each value is defined, by block and index
+    std::vector<std::optional<std::pair<uint32_t, uint32_t>>> definition(func.value_count());
+    std::vector<std::vector<bool>> live(blocks.size());
+    std::vector<std::pair<uint32_t, uint32_t>> to_visit;
+    for (auto block = 0u; block < blocks.size(); ++block) {
+        const auto & code = blocks[block].instructions;
+        live[block].resize(code.size(), false);
+        for (auto index = 0u; index < code.size(); ++index) {
+            if (code[index].result.has_value())
+                definition[code[index].result->id].emplace(block, index);
+            if (code[index].side_effects() or not code[index].result.has_value()
+                or may_fault(func, code[index])) {
+                live[block][index] = true;
+                to_visit.emplace_back(block, index);
+            }
+        }
+    }
+
+    // Whatever a live instruction uses is live too. Starting from what has to stay means
+    // values that only feed each other, like a loop counter nothing reads, are dropped.
+    while (not to_visit.empty()) {
+        auto [block, index] = to_visit.back();
+        to_visit.pop_back();
+        for (auto & arg : blocks[block].instructions[index].args) {
+            const auto & defined = definition[arg.id];
+            if (not defined.has_value() or live[defined->first][defined->second]) continue;
+            live[defined->first][defined->second] = true;
+            to_visit.push_back(*defined);
+        }
+    }
+
+    for (auto block = 0u; block < blocks.size(); ++block) {
+        auto & code = blocks[block].instructions;
+        std::vector<instruction> kept;
+        kept.reserve(code.size());
+        for (auto index = 0u; index < code.size(); ++index)
+            if (live[block][index]) kept.push_back(std::move(code[index]));
+        code = std::move(kept);
+    }
+}
+
+} // namespace ir
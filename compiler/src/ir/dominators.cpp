@@ -0,0 +1,70 @@
+#include "dominators.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace ir {
+
+dominator_tree::dominator_tree(const modul::function_details & func)
+    : idoms(func.blocks.size(), UINT32_MAX)
+    , dominated(func.blocks.size())
+    , order_index(func.blocks.size(), UINT32_MAX) {
+
+    // Postorder by an iterative depth first search, each block with its next successor to visit
+    std::vector<std::pair<uint32_t, uint32_t>> to_visit{{0, 0}};
+    std::vector<bool> visited(func.blocks.size(), false);
+    visited[0] = true;
+    while (not to_visit.empty()) {
+        auto & [block, next] = to_visit.back();
+        const auto successors = func.blocks[block].successors();
+        if (next == successors.size()) {
+            order.push_back(block);
+            to_visit.pop_back();
+            continue;
+        }
+        auto successor = successors[next++];
+        if (visited[successor]) continue;
+        visited[successor] = true;
+        to_visit.emplace_back(successor, 0);
+    }
+    assert(order.size() == func.blocks.size());
+    std::reverse(order.begin(), order.end());
+    for (auto i = 0u; i < order.size(); ++i) order_index[order[i]] = i;
+
+    // Walks up from both blocks until they meet, whichever is later in order moves first
+    auto intersect = [this](uint32_t lhs, uint32_t rhs) {
+        while (lhs != rhs) {
+            while (order_index[lhs] > order_index[rhs]) lhs = idoms[lhs];
+            while (order_index[rhs] > order_index[lhs]) rhs = idoms[rhs];
+        }
+        return lhs;
+    };
+
+    idoms[0] = 0;
+    for (auto changed = true; changed;) {
+        changed = false;
+        for (auto iter = std::next(order.begin()); iter != order.end(); ++iter) {
+            auto new_idom = UINT32_MAX;
+            for (auto predecessor : func.blocks[*iter].predecessors) {
+                if (idoms[predecessor] == UINT32_MAX) continue;
+                new_idom = new_idom == UINT32_MAX ? predecessor : intersect(predecessor, new_idom);
+            }
+            assert(new_idom != UINT32_MAX);
+            if (idoms[*iter] == new_idom) continue;
+            idoms[*iter] = new_idom;
+            changed = true;
+        }
+    }
+
+    for (auto block : order)
+        if (block != 0) dominated[idoms[block]].push_back(block);
+}
+
+bool dominator_tree::dominates(uint32_t dominator, uint32_t block) const {
+    // Dominators come before what they dominate, so stop once past dominator
+    while (order_index[block] > order_index[dominator]) block = idoms[block];
+    return block == dominator;
+}
+
+} // namespace ir
@@ -0,0 +1,51 @@
+#ifndef DOMINATORS_H
+#define DOMINATORS_H
+
+#include "ir.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace ir {
+
+// Which blocks of a function every path from the entry goes through, as in Cooper, Harvey and
+// Kennedy, "A Simple, Fast Dominance Algorithm". Every block must be reachable from the entry.
+class dominator_tree final {
+  public:
+    explicit dominator_tree(const modul::function_details &);
+
+    dominator_tree(const dominator_tree &) = delete;
+    dominator_tree & operator=(const dominator_tree &) = delete;
+
+    dominator_tree(dominator_tree &&) noexcept = default;
+    dominator_tree & operator=(dominator_tree &&) noexcept = default;
+
+    ~dominator_tree() noexcept = default;
+
+    // The closest block dominating block, the entry is its own
+    [[nodiscard]] uint32_t immediate_dominator(uint32_t block) const { return idoms[block]; }
+
+    // Whether every path to block goes through dominator, a block dominates itself
+    [[nodiscard]] bool dominates(uint32_t dominator, uint32_t block) const;
+
+    // The blocks block immediately dominates
+    [[nodiscard]] const std::vector<uint32_t> & children(uint32_t block) const {
+        return dominated[block];
+    }
+
+    // Every block before its successors, except along back edges
+    [[nodiscard]] const std::vector<uint32_t> & reverse_postorder() const noexcept {
+        return order;
+    }
+
+  private:
+    std::vector<uint32_t> idoms;
+    std::vector<std::vector<uint32_t>> dominated;
+    std::vector<uint32_t> order;
+    // Each block's index in order
+    std::vector<uint32_t> order_index;
+};
+
+} // namespace ir
+
+#endif
@@ -0,0 +1,106 @@
+#include "folding.h"
+
+#include "literals.h"
+
+#include <cstdint>
+
+namespace ir {
+
+namespace {
+std::optional<bool> boolean_value(const std::string & text) {
+    if (text == "true") return true;
+    if (text == "false") return false;
+    return std::nullopt;
+}
+
+std::string boolean_text(bool value) { return value ? "true" : "false"; }
+
+std::optional<std::string> fold_integers(operation op, uint32_t lhs, uint32_t rhs) {
+    const auto signed_lhs = static_cast<int32_t>(lhs);
+    const auto signed_rhs = static_cast<int32_t>(rhs);
+    switch (op) {
+    case operation::add:
+        return std::to_string(lhs + rhs);
+    case operation::sub:
+        return std::to_string(lhs - rhs);
+    case operation::mul:
+        return std::to_string(lhs * rhs);
+    case operation::div:
+    case operation::rem:
+        if (rhs == 0 or (signed_lhs == INT32_MIN and signed_rhs == -1)) return std::nullopt;
+        return std::to_string(static_cast<uint32_t>(
+            op == operation::div ? signed_lhs / signed_rhs : signed_lhs % signed_rhs));
+    case operation::bit_and:
+        return std::to_string(lhs & rhs);
+    case operation::bit_or:
+        return std::to_string(lhs | rhs);
+    case operation::bit_xor:
+        return std::to_string(lhs ^ rhs);
+    case operation::bit_left:
+        if (rhs >= 32) return std::nullopt;
+        return std::to_string(lhs << rhs);
+    case operation::bit_right:
+        if (rhs >= 32) return std::nullopt;
+        return std::to_string(static_cast<uint32_t>(signed_lhs >> rhs));
+    case operation::less_eq:
+        return boolean_text(signed_lhs <= signed_rhs);
+    case operation::less:
+        return boolean_text(signed_lhs < signed_rhs);
+    case operation::greater_eq:
+        return boolean_text(signed_lhs >= signed_rhs);
+    case operation::greater:
+        return boolean_text(signed_lhs > signed_rhs);
+    case operation::equal:
+        return boolean_text(lhs == rhs);
+    case operation::not_equal:
+        return boolean_text(lhs != rhs);
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<std::string> fold_booleans(operation op, bool lhs, bool rhs) {
+    switch (op) {
+    case operation::equal:
+        return boolean_text(lhs == rhs);
+    case operation::not_equal:
+        return boolean_text(lhs != rhs);
+    default:
+        return std::nullopt;
+    }
+}
+} // namespace
+
+std::optional<std::string> fold(operation op, type_ptr typ,
+                                const std::vector<std::string> & args) {
+    if (typ == integer_type::instance) {
+        std::vector<uint32_t> values;
+        for (auto & arg : args) {
+            auto value = integer_value(arg);
+            if (not value.has_value()) return std::nullopt;
+            values.push_back(*value);
+        }
+        if (values.size() == 2) return fold_integers(op, values[0], values[1]);
+        if (values.size() != 1) return std::nullopt;
+        if (op == operation::negation) return std::to_string(0u - values[0]);
+        if (op == operation::bit_not) return std::to_string(~values[0]);
+        return std::nullopt;
+    }
+
+    if (typ == boolean_type::instance) {
+        std::vector<bool> values;
+        for (auto & arg : args) {
+            auto value = boolean_value(arg);
+            if (not value.has_value()) return std::nullopt;
+            values.push_back(*value);
+        }
+        if (values.size() == 2) return fold_booleans(op, values[0], values[1]);
+        if (values.size() == 1 and op == operation::boolean_not) return boolean_text(not values[0]);
+        return std::nullopt;
+    }
+
+    // TODO: Floating point and characters
+    return std::nullopt;
+}
+
+} // namespace ir
@@ -0,0 +1,22 @@
+#ifndef FOLDING_H
+#define FOLDING_H
+
+#include "ir_forward.h"
+#include "type.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace ir {
+
+// The literal op gives for literal args of type typ, written as a literal would be, or nothing
+// when it can't be worked out at compile time. Integers are 32 bit two's complement, compared as
+// signed and shifted right arithmetically. Division by zero, overflowing division and shifts by
+// 32 or more are left for run time.
+[[nodiscard]] std::optional<std::string> fold(operation, type_ptr typ,
+                                              const std::vector<std::string> & args);
+
+} // namespace ir
+
+#endif
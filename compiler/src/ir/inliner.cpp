@@ -0,0 +1,135 @@
+#include "folding.h"
+#include "ir.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ir {
+
+namespace {
+// Whether the function's body is small enough, and is a single block ending in its only return
+bool inlinable(const modul::function_details & func, uint32_t max_size) {
+    if (func.blocks.size() != 1) return false;
+    const auto & body = func.straight_line_code();
+    if (body.empty() or body.back().op != operation::ret) return false;
+    if (body.size() - 1 > max_size) return false;
+    return std::none_of(body.begin(), body.end() - 1,
+                        [](const instruction & inst) { return inst.op == operation::ret; });
+}
+
+// The functions that can end up calling themselves, directly or through others
+std::set<std::string>
+recursive_functions(const std::map<std::string, modul::function_details> & functions) {
+    std::map<std::string, std::set<std::string>> callees;
+    for (auto & [name, func] : functions)
+        for (auto & block : func.blocks)
+            for (auto & inst : block.instructions)
+                if (inst.op == operation::call)
+                    callees[name].insert(func.text_of(inst.args.front()));
+
+    std::set<std::string> recursive;
+    for (auto & iter : functions) {
+        std::set<std::string> reached;
+        std::vector<std::string> pending{callees[iter.first].begin(), callees[iter.first].end()};
+        while (not pending.empty() and reached.count(iter.first) == 0) {
+            auto next = std::move(pending.back());
+            pending.pop_back();
+            if (not reached.insert(next).second) continue;
+            pending.insert(pending.end(), callees[next].begin(), callees[next].end());
+        }
+        if (reached.count(iter.first) != 0) recursive.insert(iter.first);
+    }
+    return recursive;
+}
+} // namespace
+
+void modul::inline_calls(uint32_t max_size) {
+    // Inlining a function into itself would never end, so recursive functions keep their calls.
+    // Every other callee was declared before its caller, so going by number inlines into it
+    // before it gets inlined itself, and it is never the body being rewritten.
+    const auto recursive = recursive_functions(functions);
+    std::vector<std::pair<uint32_t, function_details *>> by_number;
+    for (auto & iter : functions) by_number.emplace_back(iter.second.number, &iter.second);
+    std::sort(by_number.begin(), by_number.end());
+
+    std::set<std::string> inlined;
+    for (auto & [number, func] : by_number) {
+        for (auto & block : func->blocks) {
+            std::vector<instruction> output;
+            output.reserve(block.instructions.size());
+            for (auto & inst : block.instructions) {
+                if (inst.op == operation::call) {
+                    assert(not inst.args.empty());
+                    // Copied, splicing adds to the value table the name is in
+                    const auto callee_name = func->text_of(inst.args.front());
+                    if (const auto & callee = functions.at(callee_name);
+                        recursive.count(callee_name) == 0 and inlinable(callee, max_size)) {
+                        assert(&callee != func);
+                        splice(callee, inst, *func, output);
+                        inlined.insert(callee_name);
+                        continue;
+                    }
+                }
+                output.push_back(std::move(inst));
+            }
+            block.instructions = std::move(output);
+        }
+    }
+
+    std::set<std::string> still_called;
+    for (auto & iter : functions)
+        for (auto & block : iter.second.blocks)
+            for (auto & inst : block.instructions)
+                if (inst.op == operation::call)
+                    still_called.insert(iter.second.text_of(inst.args.front()));
+    for (auto & name : inlined)
+        if (name != "main" and still_called.count(name) == 0) functions.erase(name);
+}
+
+void modul::splice(const function_details & callee, const instruction & call,
+                   function_details & caller, std::vector<instruction> & output) {
+    assert(call.args.size() == callee.parameters.size() + 1);
+    // The caller's value for each of the callee's values, once it has one
+    std::vector<std::optional<operand>> renamed(callee.value_count());
+    for (auto i = 0u; i < callee.parameters.size(); ++i)
+        renamed[callee.parameters[i].id] = call.args[i + 1];
+    auto rename = [&renamed, &callee, &caller](const operand & value) {
+        auto & found = renamed[value.id];
+        if (not found.has_value()) {
+            auto kind = callee.kind_of(value);
+            assert(kind == value_kind::literal or kind == value_kind::function);
+            found = caller.intern(kind, callee.text_of(value), value.typ);
+        }
+        return *found;
+    };
+
+    // Everything but the return
+    const auto & body = callee.straight_line_code();
+    for (auto iter = body.begin(); iter + 1 != body.end(); ++iter) {
+        auto copy = *iter;
+        for (auto & arg : copy.args) arg = rename(arg);
+        // Arguments that are literals may make the result one too
+        std::vector<std::string> texts;
+        for (auto & arg : copy.args)
+            if (caller.kind_of(arg) == value_kind::literal) texts.push_back(caller.text_of(arg));
+        if (copy.result.has_value() and texts.size() == copy.args.size()) {
+            if (auto folded = fold(copy.op, copy.args.front().typ, texts)) {
+                renamed[copy.result->id]
+                    = caller.intern(value_kind::literal, *folded, copy.result->typ);
+                continue;
+            }
+        }
+        if (copy.result.has_value()) {
+            auto fresh = caller.add_temporary(copy.result->typ);
+            renamed[copy.result->id] = fresh;
+            copy.result = std::move(fresh);
+        }
+        output.push_back(std::move(copy));
+    }
+}
+
+} // namespace ir
@@ -1,24 +1,46 @@
 #include "ir.h"
 
 #include "ast/nodes.h"
+#include "dominators.h"
+#include "folding.h"
+#include "literals.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
+#include <iterator>
 
 namespace ir {
 
-type_ptr string_type::instance = std::make_shared<string_type>();
-type_ptr integer_type::instance = std::make_shared<integer_type>();
-type_ptr floating_type::instance = std::make_shared<floating_type>();
-type_ptr boolean_type::instance = std::make_shared<boolean_type>();
-type_ptr character_type::instance = std::make_shared<character_type>();
-type_ptr unit_type::instance = std::make_shared<unit_type>();
+namespace {
+const string_type string_instance{};
+const integer_type integer_instance{};
+const floating_type floating_instance{};
+const boolean_type boolean_instance{};
+const character_type character_instance{};
+const unit_type unit_instance{};
+} // namespace
+
+const type_ptr string_type::instance = &string_instance;
+const type_ptr integer_type::instance = &integer_instance;
+const type_ptr floating_type::instance = &floating_instance;
+const type_ptr boolean_type::instance = &boolean_instance;
+const type_ptr character_type::instance = &character_instance;
+const type_ptr unit_type::instance = &unit_instance;
 
 type_ptr ast_to_ir_type(const std::string & ast) {
 
     if (ast == "string") {
         return string_type::instance;
+    } else if (ast == "i32" or ast == "i64") {
+        return integer_type::instance;
+    } else if (ast == "f32" or ast == "f64") {
+        return floating_type::instance;
+    } else if (ast == "bool") {
+        return boolean_type::instance;
+    } else if (ast == "char") {
+        return character_type::instance;
     } else if (ast.empty()) {
         return unit_type::instance;
     }
@@ -37,6 +59,46 @@ void func_type::print(std::ostream & lhs) const {
     for (auto & typ : arg_types) lhs << *typ << ", ";
     lhs << ") " << *ret_type;
 }
+void struct_type::print(std::ostream & lhs) const { lhs << name; }
+
+type_context & type_context::global() {
+    static type_context context;
+    return context;
+}
+
+type_ptr type_context::function(std::vector<type_ptr> args, type_ptr ret) {
+    auto & found = functions[{args, ret}];
+    if (found == nullptr) found = std::make_unique<func_type>(std::move(args), ret);
+    return found.get();
+}
+
+type_ptr type_context::structure(std::string name, std::vector<struct_type::field> fields) {
+    auto & found = structs[{name, fields}];
+    if (found == nullptr) found = std::make_unique<struct_type>(std::move(name), std::move(fields));
+    return found.get();
+}
+
+namespace {
+// As in boost::hash_combine
+void combine(size_t & seed, size_t hash) {
+    seed ^= hash + 0x9e37'79b9 + (seed << 6) + (seed >> 2);
+}
+} // namespace
+
+size_t type_context::key_hash::operator()(const func_key & key) const noexcept {
+    auto seed = std::hash<type_ptr>{}(key.second);
+    for (auto arg : key.first) combine(seed, std::hash<type_ptr>{}(arg));
+    return seed;
+}
+
+size_t type_context::key_hash::operator()(const struct_key & key) const noexcept {
+    auto seed = std::hash<std::string>{}(key.first);
+    for (auto & [name, typ] : key.second) {
+        combine(seed, std::hash<std::string>{}(name));
+        combine(seed, std::hash<type_ptr>{}(typ));
+    }
+    return seed;
+}
 
 // Top level item compilation
 
@@ -46,19 +108,40 @@ void modul::register_function(std::string id, const std::vector<ast::typed_id> &
 
     assert(functions.find(id) == functions.end());
 
-    std::vector<operand> parameters;
+    std::vector<std::pair<std::string, type_ptr>> parameters;
     for (auto & param : params) {
         auto [id, type] = param.id_and_type();
-        parameters.push_back({id, ast_to_ir_type(type)});
+        parameters.emplace_back(id, type_for(type));
     }
-    functions.insert_or_assign(
-        id, function_details{{}, std::move(parameters), type.value_or(""), func_num++});
+    functions.insert_or_assign(id,
+                               function_details{parameters, type.value_or(""), func_num++});
     current_func_name = id;
+    builder = {};
+    // Nothing jumps to the entry
+    seal_block(0);
+    for (auto & param : current_function().parameters) {
+        const auto & name = current_function().text_of(param);
+        builder.variables.emplace(name, param.typ);
+        write_variable(name, 0, param);
+    }
     body.build(*this);
+    finish_function();
     current_func_name.clear();
 }
 
-void modul::register_struct(std::string, const std::vector<ast::typed_id> &) {}
+void modul::register_struct(std::string id, const std::vector<ast::typed_id> & params) {
+    if (structs.count(id) != 0) {
+        std::cout << "Struct " << id << " is declared twice" << std::endl;
+        exit(2);
+    }
+
+    std::vector<struct_type::field> fields;
+    for (auto & param : params) {
+        auto [name, type] = param.id_and_type();
+        fields.emplace_back(name, type_for(type));
+    }
+    structs.emplace(id, type_context::global().structure(id, std::move(fields)));
+}
 
 // Statment compilation
 
@@ -67,28 +150,181 @@ void modul::call_function(std::string id, std::vector<operand> args) {
     auto iter = functions.find(id);
     assert(iter != functions.end());
 
-    args.insert(args.begin(), {id, iter->second.func_type()});
-    current_function().instructions.emplace_back(operation::call, args, std::nullopt);
+    args.insert(args.begin(),
+                current_function().intern(value_kind::function, id, iter->second.func_type()));
+    emit({operation::call, std::move(args), std::nullopt});
+}
+
+namespace {
+// The operation a compound assignment applies before storing
+ast::binary_operation binary_for(ast::assignment_operation op) {
+    switch (op) {
+    case ast::assignment_operation::add:
+        return ast::binary_operation::add;
+    case ast::assignment_operation::sub:
+        return ast::binary_operation::sub;
+    case ast::assignment_operation::mul:
+        return ast::binary_operation::mul;
+    case ast::assignment_operation::div:
+        return ast::binary_operation::div;
+    case ast::assignment_operation::remainder:
+        return ast::binary_operation::rem;
+    case ast::assignment_operation::bit_and:
+        return ast::binary_operation::bit_and;
+    case ast::assignment_operation::bit_or:
+        return ast::binary_operation::bit_or;
+    case ast::assignment_operation::bit_left:
+        return ast::binary_operation::bit_left;
+    case ast::assignment_operation::bit_right:
+        return ast::binary_operation::bit_right;
+    case ast::assignment_operation::bit_xor:
+        return ast::binary_operation::bit_xor;
+    case ast::assignment_operation::assign:
+        break;
+    }
+    assert(false);
+    return ast::binary_operation::add;
+}
+} // namespace
+
+void modul::define_variable(const std::string & id, const std::optional<std::string> & type,
+                            operand value) {
+    if (type.has_value() and type_for(*type) != value.typ) {
+        std::cout << "Cannot initialize " << id << " of type " << *type << " with "
+                  << *value.typ << std::endl;
+        exit(2);
+    }
+    builder.variables.insert_or_assign(id, value.typ);
+    write_variable(id, builder.block, std::move(value));
+}
+
+void modul::assign_variable(const std::string & id, ast::assignment_operation op,
+                            operand value) {
+    auto iter = builder.variables.find(id);
+    if (iter == builder.variables.end()) {
+        std::cout << "Unknown variable: " << id << std::endl;
+        exit(2);
+    }
+
+    if (op != ast::assignment_operation::assign)
+        value = compile_binary_op(binary_for(op), read_variable(id, builder.block),
+                                  std::move(value));
+    if (value.typ != iter->second) {
+        std::cout << "Cannot assign " << *value.typ << " to " << id << " of type "
+                  << *iter->second << std::endl;
+        exit(2);
+    }
+    write_variable(id, builder.block, std::move(value));
+}
+
+void modul::compile_if(const ast::expression & cond, const ast::statement & then_block,
+                       const ast::statement * else_block) {
+    auto condition = cond.compile(*this);
+    check_condition(condition);
+
+    const auto then_start = new_block();
+    const auto else_start = else_block != nullptr ? std::optional{new_block()} : std::nullopt;
+    const auto merge = new_block();
+    branch(condition, then_start, else_start.value_or(merge));
+
+    seal_block(then_start);
+    builder.block = then_start;
+    then_block.build(*this);
+    jump_to(merge);
+
+    if (else_start.has_value()) {
+        seal_block(*else_start);
+        builder.block = *else_start;
+        else_block->build(*this);
+        jump_to(merge);
+    }
+
+    seal_block(merge);
+    builder.block = merge;
+}
+
+void modul::compile_while(const ast::expression & cond, const ast::statement & body) {
+    compile_loop(cond, body, nullptr);
+}
+
+void modul::compile_for(const ast::statement & initial, const ast::expression & cond,
+                        const ast::statement & increment, const ast::statement & body) {
+    initial.build(*this);
+    compile_loop(cond, body, &increment);
+}
+
+void modul::compile_loop(const ast::expression & cond, const ast::statement & body,
+                         const ast::statement * increment) {
+    const auto header = new_block();
+    const auto body_start = new_block();
+    const auto exit = new_block();
+    jump_to(header);
+
+    // The header stays unsealed until the back edge from the end of the body exists
+    builder.block = header;
+    auto condition = cond.compile(*this);
+    check_condition(condition);
+    branch(condition, body_start, exit);
+
+    seal_block(body_start);
+    builder.block = body_start;
+    body.build(*this);
+    if (increment != nullptr) increment->build(*this);
+    jump_to(header);
+
+    seal_block(header);
+    seal_block(exit);
+    builder.block = exit;
+}
+
+void modul::compile_return(std::optional<operand> value) {
+    std::vector<operand> args;
+    if (value.has_value()) args.push_back(std::move(*value));
+    emit({operation::ret, std::move(args), std::nullopt});
+
+    // Anything after the return is unreachable, it goes in a block nothing jumps to
+    builder.block = new_block();
+    seal_block(builder.block);
 }
 
 // Expression compilation
 
 operand modul::compile_literal(const std::string & value, ast::type typ) {
+    type_ptr ir_type;
     switch (typ) {
     case ast::type::string:
-        return {value, string_type::instance};
+        ir_type = string_type::instance;
+        break;
     case ast::type::integer:
-        return {value, integer_type::instance};
+        if (not integer_value(value).has_value()) {
+            std::cout << "Integer literal " << value << " does not fit in 32 bits" << std::endl;
+            exit(2);
+        }
+        ir_type = integer_type::instance;
+        break;
     case ast::type::floating:
-        return {value, floating_type::instance};
+        ir_type = floating_type::instance;
+        break;
     case ast::type::character:
-        return {value, character_type::instance};
+        ir_type = character_type::instance;
+        break;
     case ast::type::boolean:
-        return {value, boolean_type::instance};
+        ir_type = boolean_type::instance;
+        break;
     default:
         std::cout << "Unsupported ast type: " << (int)typ << std::endl;
         exit(2);
     }
+    return current_function().intern(value_kind::literal, value, ir_type);
+}
+
+operand modul::compile_variable(const std::string & id) {
+    // TODO: Globals
+    if (builder.variables.count(id) == 0) {
+        std::cout << "Unknown variable: " << id << std::endl;
+        exit(2);
+    }
+    return read_variable(id, builder.block);
 }
 
 operand modul::compile_binary_op(ast::binary_operation op, operand lhs, operand rhs) {
@@ -109,12 +345,6 @@ operand modul::compile_binary_op(ast::binary_operation op, operand lhs, operand
     case ast::binary_operation::rem:
         ir_op = ir::operation::rem;
         break;
-    case ast::binary_operation::boolean_and:
-        ir_op = ir::operation::boolean_and;
-        break;
-    case ast::binary_operation::boolean_or:
-        ir_op = ir::operation::boolean_or;
-        break;
     case ast::binary_operation::less_eq:
         ir_op = ir::operation::less_eq;
         break;
@@ -154,39 +384,181 @@ operand modul::compile_binary_op(ast::binary_operation op, operand lhs, operand
     }
 
     assert(lhs.typ == rhs.typ);
-    auto result = temp_operand(lhs.typ);
-    current_function().instructions.push_back({ir_op, {lhs, rhs}, result});
+    // Comparisons give booleans, arithmetic gives what it works on
+    auto gives_boolean = false;
+    switch (op) {
+    case ast::binary_operation::less_eq:
+    case ast::binary_operation::less:
+    case ast::binary_operation::greater_eq:
+    case ast::binary_operation::greater:
+    case ast::binary_operation::equal:
+    case ast::binary_operation::not_equal:
+        gives_boolean = true;
+        break;
+    default:
+        break;
+    }
+    auto result_type = gives_boolean ? boolean_type::instance : lhs.typ;
+    if (auto folded = fold_literals(ir_op, result_type, {lhs, rhs})) return *folded;
+    auto result = temp_operand(result_type);
+    emit({ir_op, {std::move(lhs), std::move(rhs)}, result});
+    return result;
+}
+
+operand modul::compile_unary_op(ast::unary_operation op, operand value) {
+    ir::operation ir_op;
+    switch (op) {
+    case ast::unary_operation::boolean_not:
+        ir_op = ir::operation::boolean_not;
+        break;
+    case ast::unary_operation::negation:
+        ir_op = ir::operation::negation;
+        break;
+    case ast::unary_operation::bit_not:
+        ir_op = ir::operation::bit_not;
+        break;
+    default:
+        std::cout << "Unsupported ast unary op: " << (int)op << std::endl;
+        exit(2);
+    }
+
+    auto result_type = op == ast::unary_operation::boolean_not ? boolean_type::instance
+                                                                : value.typ;
+    if (auto folded = fold_literals(ir_op, result_type, {value})) return *folded;
+    auto result = temp_operand(result_type);
+    emit({ir_op, {std::move(value)}, result});
+    return result;
+}
+
+operand modul::compile_if_expr(const ast::expression & cond, const ast::expression & true_case,
+                               const ast::expression & false_case) {
+    auto condition = cond.compile(*this);
+    check_condition(condition);
+
+    const auto true_start = new_block();
+    const auto false_start = new_block();
+    const auto merge = new_block();
+    branch(condition, true_start, false_start);
+
+    seal_block(true_start);
+    builder.block = true_start;
+    auto true_value = true_case.compile(*this);
+    jump_to(merge);
+
+    seal_block(false_start);
+    builder.block = false_start;
+    auto false_value = false_case.compile(*this);
+    jump_to(merge);
+
+    seal_block(merge);
+    builder.block = merge;
+    if (true_value.typ != false_value.typ) {
+        std::cout << "Both cases of an if expression need the same type, not " << *true_value.typ
+                  << " and " << *false_value.typ << std::endl;
+        exit(2);
+    }
+    auto result = temp_operand(true_value.typ);
+    // Each case jumped to the merge from wherever it ended, in order
+    emit({operation::phi,
+          {std::move(true_value), std::move(false_value)},
+          result,
+          current_function().blocks[merge].predecessors});
+    return result;
+}
+
+operand modul::compile_short_circuit(ast::binary_operation op, const ast::expression & lhs,
+                                     const ast::expression & rhs) {
+    assert(op == ast::binary_operation::boolean_and or op == ast::binary_operation::boolean_or);
+    const auto is_and = op == ast::binary_operation::boolean_and;
+    auto lhs_value = lhs.compile(*this);
+    check_condition(lhs_value);
+
+    // && is false without looking at rhs when lhs is, || is true when lhs is
+    const auto rhs_start = new_block();
+    const auto merge = new_block();
+    if (is_and)
+        branch(lhs_value, rhs_start, merge);
+    else
+        branch(lhs_value, merge, rhs_start);
+    auto decided = compile_literal(is_and ? "false" : "true", ast::type::boolean);
+
+    seal_block(rhs_start);
+    builder.block = rhs_start;
+    auto rhs_value = rhs.compile(*this);
+    check_condition(rhs_value);
+    jump_to(merge);
+
+    seal_block(merge);
+    builder.block = merge;
+    auto result = temp_operand(boolean_type::instance);
+    // The branch on lhs came first, then rhs jumped from wherever it ended
+    emit({operation::phi,
+          {std::move(decided), std::move(rhs_value)},
+          result,
+          current_function().blocks[merge].predecessors});
     return result;
 }
 
 modul::modul(std::string filename)
     : filename{std::move(filename)} {
-    functions.emplace(
-        "print",
-        function_details{std::vector{instruction{operation::syscall,
-                                                 {
-                                                     operand{"3", integer_type::instance},
-                                                     operand{"input", string_type::instance},
-                                                     operand{"0", integer_type::instance},
-                                                     operand{"0", integer_type::instance},
-                                                     operand{"1", integer_type::instance},
-                                                 },
-                                                 {}},
-                                     instruction{operation::ret, {}, {}}},
-                         std::vector{operand{"input", string_type::instance}}, "", func_num++});
-}
-
-modul::function_details::function_details(const std::vector<operand> & parameters,
-                                          const std::optional<std::string> & opt_ret_type,
-                                          uint32_t number)
-    : parameters{parameters}
-    , return_type{opt_ret_type.value_or("")}
-    , number{number} {}
+    // Builtins are a syscall with the function number last, then a return
+    auto add_syscall = [this](const std::string & name, std::optional<std::string> param,
+                              const char * first, const char * func) {
+        std::vector<std::pair<std::string, type_ptr>> params;
+        if (param.has_value()) params.emplace_back(*param, string_type::instance);
+        auto [iter, inserted] = functions.emplace(name, function_details{params, "", func_num++});
+        assert(inserted);
+        auto & details = iter->second;
+        auto integer = [&details](const char * text) {
+            return details.intern(value_kind::literal, text, integer_type::instance);
+        };
+        auto zero = integer("0");
+        details.blocks.front().instructions = {
+            instruction{operation::syscall,
+                        {integer(first), param.has_value() ? details.parameters.front() : zero,
+                         zero, zero, integer(func)},
+                        std::nullopt},
+            instruction{operation::ret, {}, std::nullopt},
+        };
+    };
+    add_syscall("print", "input", "3", "1");
+    add_syscall("flush", std::nullopt, "0", "2");
+}
+
+modul::function_details::function_details(
+    const std::vector<std::pair<std::string, type_ptr>> & params, std::string ret_type,
+    uint32_t number)
+    : blocks(1)
+    , return_type{std::move(ret_type)}
+    , number{number} {
+    parameters.reserve(params.size());
+    values.reserve(params.size());
+    for (auto & [name, typ] : params) {
+        parameters.push_back({value_count(), typ});
+        values.push_back({value_kind::parameter, name});
+    }
+}
+
+operand modul::function_details::add_temporary(type_ptr type) {
+    values.push_back({value_kind::temporary, {}});
+    return {value_count() - 1, type};
+}
+
+operand modul::function_details::intern(value_kind kind, const std::string & text,
+                                        type_ptr type) {
+    assert(kind == value_kind::literal or kind == value_kind::function);
+    auto [iter, inserted] = interned.emplace(text, value_count());
+    if (inserted)
+        values.push_back({kind, text});
+    else
+        assert(values[iter->second].kind == kind);
+    return {iter->second, type};
+}
 
 type_ptr modul::function_details::generate_type() const {
     std::vector<type_ptr> args;
     for (auto & param : parameters) args.push_back(param.typ);
-    return std::make_shared<ir::func_type>(std::move(args), ast_to_ir_type(return_type));
+    return type_context::global().function(std::move(args), ast_to_ir_type(return_type));
 }
 
 modul::function_details & modul::current_function() {
@@ -195,8 +567,265 @@ modul::function_details & modul::current_function() {
     return iter->second;
 }
 
+type_ptr modul::type_for(const std::string & name) const {
+    if (auto iter = structs.find(name); iter != structs.end()) return iter->second;
+    return ast_to_ir_type(name);
+}
+
 operand modul::temp_operand(type_ptr type) {
-    return {"temp_" + std::to_string(temp_num++), std::move(type)};
+    return current_function().add_temporary(type);
+}
+
+std::optional<operand> modul::fold_literals(operation op, type_ptr result_type,
+                                            const std::vector<operand> & args) {
+    auto & func = current_function();
+    std::vector<std::string> texts;
+    for (auto & arg : args) {
+        if (func.kind_of(arg) != value_kind::literal) return std::nullopt;
+        texts.push_back(func.text_of(arg));
+    }
+    auto folded = fold(op, args.front().typ, texts);
+    if (not folded.has_value()) return std::nullopt;
+    return func.intern(value_kind::literal, *folded, result_type);
+}
+
+void modul::check_condition(const operand & condition) {
+    if (condition.typ == boolean_type::instance) return;
+    std::cout << "Conditions must be bool, not " << *condition.typ << std::endl;
+    exit(2);
+}
+
+uint32_t modul::new_block() {
+    auto & blocks = current_function().blocks;
+    blocks.emplace_back();
+    return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void modul::emit(instruction inst) {
+    auto & block = current_function().blocks[builder.block];
+    assert(not block.terminated());
+    block.instructions.push_back(std::move(inst));
+}
+
+void modul::jump_to(uint32_t block) {
+    const auto from = builder.block;
+    emit({operation::jump, {}, std::nullopt, {block}});
+    current_function().blocks[block].predecessors.push_back(from);
+}
+
+void modul::branch(const operand & cond, uint32_t true_block, uint32_t false_block) {
+    const auto from = builder.block;
+    emit({operation::branch, {cond}, std::nullopt, {true_block, false_block}});
+    auto & blocks = current_function().blocks;
+    blocks[true_block].predecessors.push_back(from);
+    blocks[false_block].predecessors.push_back(from);
+}
+
+void modul::write_variable(const std::string & id, uint32_t block, operand value) {
+    builder.definitions.insert_or_assign({id, block}, std::move(value));
+}
+
+operand modul::read_variable(const std::string & id, uint32_t block) {
+    if (auto iter = builder.definitions.find({id, block}); iter != builder.definitions.end())
+        return iter->second;
+    return read_variable_recursive(id, block);
+}
+
+operand modul::read_variable_recursive(const std::string & id, uint32_t block) {
+    const auto predecessors = current_function().blocks[block].predecessors;
+    operand value;
+    if (builder.sealed.count(block) == 0) {
+        // Not every way in is known yet, the phi gets its operands when the block is sealed
+        value = add_phi(id, block);
+        builder.incomplete_phis[block].emplace_back(id, value);
+    } else if (predecessors.empty()) {
+        if (block == 0) {
+            std::cout << "Variable " << id << " may be used before it is defined" << std::endl;
+            exit(2);
+        }
+        // Nothing reaches the block, it is dropped once the function is built
+        value = temp_operand(builder.variables.at(id));
+    } else if (predecessors.size() == 1) {
+        value = read_variable(id, predecessors.front());
+    } else {
+        // Written before reading the predecessors, so a loop back to here finds the phi
+        value = add_phi(id, block);
+        write_variable(id, block, value);
+        add_phi_operands(id, block, value);
+    }
+    write_variable(id, block, value);
+    return value;
+}
+
+operand modul::add_phi(const std::string & id, uint32_t block) {
+    auto result = temp_operand(builder.variables.at(id));
+    auto & code = current_function().blocks[block].instructions;
+    auto after_phis = std::find_if(code.begin(), code.end(), [](const instruction & inst) {
+        return inst.op != operation::phi;
+    });
+    code.insert(after_phis, instruction{operation::phi, {}, result});
+    return result;
+}
+
+void modul::add_phi_operands(const std::string & id, uint32_t block, const operand & phi) {
+    const auto predecessors = current_function().blocks[block].predecessors;
+    for (auto predecessor : predecessors) {
+        auto value = read_variable(id, predecessor);
+        // Reading may have added phis to the block, so look for this one afterwards
+        auto & code = current_function().blocks[block].instructions;
+        auto inst = std::find_if(code.begin(), code.end(), [&phi](const instruction & candidate) {
+            return candidate.op == operation::phi and candidate.result == phi;
+        });
+        assert(inst != code.end());
+        inst->args.push_back(std::move(value));
+        inst->targets.push_back(predecessor);
+    }
+}
+
+void modul::seal_block(uint32_t block) {
+    auto waiting = std::move(builder.incomplete_phis[block]);
+    builder.incomplete_phis.erase(block);
+    for (auto & [id, phi] : waiting) add_phi_operands(id, block, phi);
+    builder.sealed.insert(block);
+}
+
+void modul::finish_function() {
+    if (not current_function().blocks[builder.block].terminated())
+        emit({operation::ret, {}, std::nullopt});
+    assert(builder.incomplete_phis.empty());
+    remove_unreachable_blocks(current_function());
+    remove_trivial_phis(current_function());
+}
+
+void modul::remove_unreachable_blocks(function_details & func) {
+    auto & blocks = func.blocks;
+    std::vector<bool> reachable(blocks.size(), false);
+    std::vector<uint32_t> to_visit{0};
+    reachable[0] = true;
+    while (not to_visit.empty()) {
+        auto block = to_visit.back();
+        to_visit.pop_back();
+        for (auto next : blocks[block].successors()) {
+            if (reachable[next]) continue;
+            reachable[next] = true;
+            to_visit.push_back(next);
+        }
+    }
+
+    // The blocks left keep their order
+    static constexpr auto removed = UINT32_MAX;
+    std::vector<uint32_t> renumbered(blocks.size(), removed);
+    uint32_t kept_count = 0;
+    for (auto i = 0u; i < blocks.size(); ++i)
+        if (reachable[i]) renumbered[i] = kept_count++;
+    if (kept_count == blocks.size()) return;
+
+    std::vector<basic_block> kept;
+    kept.reserve(kept_count);
+    for (auto i = 0u; i < blocks.size(); ++i) {
+        if (not reachable[i]) continue;
+        auto & block = blocks[i];
+
+        std::vector<uint32_t> predecessors;
+        for (auto predecessor : block.predecessors)
+            if (renumbered[predecessor] != removed)
+                predecessors.push_back(renumbered[predecessor]);
+        block.predecessors = std::move(predecessors);
+
+        for (auto & inst : block.instructions) {
+            if (inst.op != operation::phi) {
+                for (auto & target : inst.targets) target = renumbered[target];
+                continue;
+            }
+            // Values coming from removed blocks never arrive
+            std::vector<operand> args;
+            std::vector<uint32_t> targets;
+            for (auto arg = 0u; arg < inst.args.size(); ++arg) {
+                if (renumbered[inst.targets[arg]] == removed) continue;
+                args.push_back(std::move(inst.args[arg]));
+                targets.push_back(renumbered[inst.targets[arg]]);
+            }
+            inst.args = std::move(args);
+            inst.targets = std::move(targets);
+        }
+        kept.push_back(std::move(block));
+    }
+    blocks = std::move(kept);
+}
+
+void modul::remove_trivial_phis(function_details & func) {
+    auto & blocks = func.blocks;
+    auto replace_uses = [&blocks](const operand & from, const operand & to) {
+        for (auto & block : blocks)
+            for (auto & inst : block.instructions)
+                for (auto & arg : inst.args)
+                    if (arg == from) arg = to;
+    };
+
+    // Replacing one phi can make another trivial
+    for (auto changed = true; changed;) {
+        changed = false;
+        for (auto & block : blocks) {
+            auto & code = block.instructions;
+            for (auto iter = code.begin(); iter != code.end() and iter->op == operation::phi;) {
+                // A phi is trivial when it only ever takes one value, besides itself
+                std::optional<operand> only;
+                auto trivial = true;
+                for (auto & arg : iter->args) {
+                    if (arg == *iter->result) continue;
+                    if (only.has_value() and *only == arg) continue;
+                    if (only.has_value()) {
+                        trivial = false;
+                        break;
+                    }
+                    only = arg;
+                }
+                if (not trivial) {
+                    ++iter;
+                    continue;
+                }
+                assert(only.has_value());
+                const auto phi = *iter->result;
+                iter = code.erase(iter);
+                replace_uses(phi, *only);
+                changed = true;
+            }
+        }
+    }
+}
+
+void modul::merge_blocks(function_details & func) {
+    auto & blocks = func.blocks;
+    auto merged = false;
+    for (auto index = 0u; index < blocks.size(); ++index) {
+        auto & block = blocks[index];
+        // The block pulled in may end in a jump too
+        while (block.terminated() and block.instructions.back().op == operation::jump) {
+            const auto next = block.instructions.back().targets.front();
+            auto & absorbed = blocks[next];
+            if (next == 0 or next == index or absorbed.predecessors.size() != 1) break;
+            // With a single way in, its phis were trivial
+            assert(absorbed.instructions.front().op != operation::phi);
+
+            block.instructions.pop_back();
+            std::move(absorbed.instructions.begin(), absorbed.instructions.end(),
+                      std::back_inserter(block.instructions));
+            for (auto successor : block.successors()) {
+                for (auto & predecessor : blocks[successor].predecessors)
+                    if (predecessor == next) predecessor = index;
+                for (auto & inst : blocks[successor].instructions) {
+                    if (inst.op != operation::phi) break;
+                    for (auto & target : inst.targets)
+                        if (target == next) target = index;
+                }
+            }
+            // Left with no way in, so it is dropped below
+            absorbed.instructions.clear();
+            absorbed.predecessors.clear();
+            merged = true;
+        }
+    }
+    if (merged) remove_unreachable_blocks(func);
 }
 
 std::ostream & operator<<(std::ostream & lhs, const ir::modul & rhs) {
@@ -205,19 +834,49 @@ std::ostream & operator<<(std::ostream & lhs, const ir::modul & rhs) {
     for (auto & iter : rhs.functions) {
         lhs << "Function " << iter.first << '\n';
         lhs << "Parameters: (";
-        for (auto & param : iter.second.parameters) lhs << *param.typ << ' ' << param.name << ", ";
+        for (auto & param : iter.second.parameters) {
+            lhs << *param.typ << ' ';
+            iter.second.print(lhs, param);
+            lhs << ", ";
+        }
         lhs << ")\n";
         lhs << "Returns " << iter.second.return_type << '\n';
-        for (auto & inst : iter.second.instructions) lhs << inst << '\n';
+        const auto & blocks = iter.second.blocks;
+        const dominator_tree dominators{iter.second};
+        for (auto i = 0u; i < blocks.size(); ++i) {
+            if (blocks.size() > 1) {
+                lhs << "Block " << i;
+                if (not blocks[i].predecessors.empty()) {
+                    lhs << " from ";
+                    for (auto predecessor : blocks[i].predecessors) lhs << predecessor << ", ";
+                    lhs << "dominated by " << dominators.immediate_dominator(i);
+                }
+                lhs << '\n';
+            }
+            for (auto & inst : blocks[i].instructions) {
+                iter.second.print(lhs, inst);
+                lhs << '\n';
+            }
+        }
         lhs << std::endl;
     }
 
     return lhs;
 }
 
-std::ostream & operator<<(std::ostream & lhs, const ir::instruction & rhs) {
-    if (rhs.result.has_value())
-        lhs << *rhs.result.value().typ << ' ' << rhs.result.value().name << " = ";
+void modul::function_details::print(std::ostream & lhs, const operand & rhs) const {
+    if (kind_of(rhs) == value_kind::temporary)
+        lhs << "temp_" << rhs.id;
+    else
+        lhs << text_of(rhs);
+}
+
+void modul::function_details::print(std::ostream & lhs, const instruction & rhs) const {
+    if (rhs.result.has_value()) {
+        lhs << *rhs.result->typ << ' ';
+        print(lhs, *rhs.result);
+        lhs << " = ";
+    }
     switch (rhs.op) {
     case operation::syscall:
         lhs << "syscall ";
@@ -243,12 +902,6 @@ std::ostream & operator<<(std::ostream & lhs, const ir::instruction & rhs) {
     case operation::rem:
         lhs << "rem ";
         break;
-    case operation::boolean_and:
-        lhs << "boolean_and ";
-        break;
-    case operation::boolean_or:
-        lhs << "boolean_or ";
-        break;
     case operation::less_eq:
         lhs << "less_eq ";
         break;
@@ -294,9 +947,25 @@ std::ostream & operator<<(std::ostream & lhs, const ir::instruction & rhs) {
     case operation::bit_not:
         lhs << "bit_not ";
         break;
+    case operation::branch:
+        lhs << "branch ";
+        break;
+    case operation::jump:
+        lhs << "jump ";
+        break;
+    case operation::phi:
+        lhs << "phi ";
+        break;
+    }
+    for (auto & arg : rhs.args) {
+        lhs << *arg.typ << ' ';
+        print(lhs, arg);
+        lhs << ", ";
+    }
+    if (not rhs.targets.empty()) {
+        lhs << (rhs.op == operation::phi ? "from " : "to ");
+        for (auto target : rhs.targets) lhs << "block " << target << ", ";
     }
-    for (auto & arg : rhs.args) lhs << *arg.typ << ' ' << arg.name << ", ";
-    return lhs;
 }
 
 } // namespace ir
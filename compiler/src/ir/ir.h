@@ -6,36 +6,82 @@
 #include "ir_forward.h"
 #include "type.h"
 
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <optional>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace ir {
 
+// Values are numbered densely within their function, its parameters first
+using value_id = uint32_t;
+
+// A value of the function being compiled. Its name or text is in the function's value table.
 struct operand {
-    std::string name;
+    value_id id;
     type_ptr typ;
 
   private:
     [[nodiscard]] friend bool operator<(const operand & lhs, const operand & rhs) {
-        return lhs.name < rhs.name;
+        return lhs.id < rhs.id;
+    }
+    [[nodiscard]] friend bool operator==(const operand & lhs, const operand & rhs) {
+        return lhs.id == rhs.id;
+    }
+    [[nodiscard]] friend bool operator!=(const operand & lhs, const operand & rhs) {
+        return lhs.id != rhs.id;
     }
 };
 
+enum class value_kind : uint8_t { parameter, temporary, literal, function };
+
+struct value_info {
+    value_kind kind;
+    // The parameter's or function's name, or the literal as written. Empty for temporaries.
+    std::string text;
+};
+
 struct instruction {
     operation op;
     // TODO: shared_ptr?
     std::vector<operand> args;
     std::optional<operand> result;
+    // The blocks a branch goes to, true then false, or a jump goes to. A phi's arguments come
+    // from the block at the same index.
+    std::vector<uint32_t> targets;
 
-    instruction(operation op, std::vector<operand> args, std::optional<operand> result)
+    instruction(operation op, std::vector<operand> args, std::optional<operand> result,
+                std::vector<uint32_t> targets = {})
         : op{op}
         , args{std::move(args)}
-        , result{std::move(result)} {}
+        , result{std::move(result)}
+        , targets{std::move(targets)} {}
 
-    friend std::ostream & operator<<(std::ostream &, const instruction &);
+    [[nodiscard]] bool terminator() const noexcept {
+        return op == operation::ret or op == operation::branch or op == operation::jump;
+    }
+    // Whether it must stay even when nothing uses its result
+    [[nodiscard]] bool side_effects() const noexcept {
+        return op == operation::call or op == operation::syscall or terminator();
+    }
+};
+
+// Phis, then straight-line code, then a terminator once the block is finished
+struct basic_block {
+    std::vector<instruction> instructions;
+    std::vector<uint32_t> predecessors;
+
+    [[nodiscard]] bool terminated() const noexcept {
+        return not instructions.empty() and instructions.back().terminator();
+    }
+    [[nodiscard]] std::vector<uint32_t> successors() const {
+        return terminated() ? instructions.back().targets : std::vector<uint32_t>{};
+    }
 };
 
 struct modul {
@@ -52,12 +98,34 @@ struct modul {
 
     void call_function(std::string id, std::vector<operand> args);
 
+    void define_variable(const std::string & id, const std::optional<std::string> & type,
+                         operand value);
+    void assign_variable(const std::string & id, ast::assignment_operation, operand value);
+
+    void compile_if(const ast::expression & cond, const ast::statement & then_block,
+                    const ast::statement * else_block);
+    void compile_while(const ast::expression & cond, const ast::statement & body);
+    void compile_for(const ast::statement & initial, const ast::expression & cond,
+                     const ast::statement & increment, const ast::statement & body);
+    void compile_return(std::optional<operand> value);
+
     // Expression compilation
 
     operand compile_literal(const std::string & value, ast::type typ);
 
+    operand compile_variable(const std::string & id);
+
     operand compile_binary_op(ast::binary_operation, operand, operand);
 
+    operand compile_unary_op(ast::unary_operation, operand);
+
+    operand compile_if_expr(const ast::expression & cond, const ast::expression & true_case,
+                            const ast::expression & false_case);
+
+    // && and ||, which only evaluate rhs when lhs doesn't already decide the result
+    operand compile_short_circuit(ast::binary_operation, const ast::expression & lhs,
+                                  const ast::expression & rhs);
+
     explicit modul(std::string filename);
 
     modul(const modul &) = delete;
@@ -69,20 +137,39 @@ struct modul {
     ~modul() noexcept = default;
 
     struct function_details {
-        std::vector<instruction> instructions;
+        // Block 0 is the entry, every block is reachable from it once the function is built
+        std::vector<basic_block> blocks;
         std::vector<operand> parameters;
         std::string return_type;
         uint32_t number;
+        // Indexed by value_id
+        std::vector<value_info> values;
 
-        function_details(const std::vector<operand> &, const std::optional<std::string> &,
-                         uint32_t);
+        // Starts with the parameters and an empty entry block
+        function_details(const std::vector<std::pair<std::string, type_ptr>> & params,
+                         std::string ret_type, uint32_t number);
 
-        function_details(std::vector<instruction> && instructions, std::vector<operand> && params,
-                         std::string && ret_type, uint32_t number)
-            : instructions{std::move(instructions)}
-            , parameters{std::move(params)}
-            , return_type{std::move(ret_type)}
-            , number{number} {}
+        [[nodiscard]] operand add_temporary(type_ptr);
+        // Literals and functions get one value each, however often they are used
+        [[nodiscard]] operand intern(value_kind, const std::string & text, type_ptr);
+
+        [[nodiscard]] value_kind kind_of(const operand & value) const {
+            return values[value.id].kind;
+        }
+        [[nodiscard]] const std::string & text_of(const operand & value) const {
+            return values[value.id].text;
+        }
+        [[nodiscard]] uint32_t value_count() const noexcept {
+            return static_cast<uint32_t>(values.size());
+        }
+
+        void print(std::ostream &, const operand &) const;
+        void print(std::ostream &, const instruction &) const;
+
+        // The instructions of a function without control flow
+        [[nodiscard]] const std::vector<instruction> & straight_line_code() const {
+            return blocks.front().instructions;
+        }
 
         type_ptr func_type() const {
             if (typ == nullptr) typ = generate_type();
@@ -93,20 +180,118 @@ struct modul {
       private:
         type_ptr generate_type() const;
 
-        mutable type_ptr typ;
+        mutable type_ptr typ = nullptr;
+        // The values of literals and functions, by text. Literals are never identifiers, so
+        // they can't clash with function names.
+        std::unordered_map<std::string, value_id> interned;
     };
 
     const std::map<std::string, function_details> & compiled_functions() const { return functions; }
 
+    // Optimization
+
+    using module_pass = std::function<void(modul &)>;
+    using function_pass = void (*)(function_details &);
+
+    // Passes run in the order they were added. With stats, each one is timed and reports how
+    // many instructions it removed.
+    void add_pass(std::string name, module_pass);
+    // Runs on every function in turn
+    void add_pass(std::string name, function_pass);
+    void run_passes(bool stats = false);
+
+    // Calls to functions with at most max_size instructions besides their return are replaced
+    // by a copy of the body. Functions left without callers are dropped.
+    void inline_calls(uint32_t max_size = default_inline_size);
+    // About what a call costs around the jal and jr, in spills, moves and reloads
+    static constexpr uint32_t default_inline_size = 4;
+
+    // Sparse conditional constant propagation, as in Wegman and Zadeck, "Constant Propagation
+    // with Conditional Branches". Values that are constant on every path that runs become
+    // literals, and branches that always go one way become jumps.
+    static void propagate_constants(function_details &);
+
+    // Global value numbering over the dominator tree. An instruction computing what one that
+    // dominates it already computed is dropped, and its result replaced by the earlier one.
+    static void number_values(function_details &);
+
+    // Drops instructions without side effects whose results are never used, along with
+    // whatever only they used. A division that could fault is kept.
+    static void remove_dead_code(function_details &);
+
+    // Lowering
+
+    // Leaves SSA form for the backend by replacing each phi with copies. Every block a value
+    // comes from copies it to a fresh value right before its terminator, then the phi becomes
+    // a copy of that. Phis reading each other still see the values from before the jump, and
+    // a block branching to several others may copy a value only one of them uses.
+    void lower_phis();
+
   private:
     [[nodiscard]] function_details & current_function();
+    // A declared struct, or a builtin type
+    [[nodiscard]] type_ptr type_for(const std::string & name) const;
     [[nodiscard]] operand temp_operand(type_ptr);
+    // The literal result of op when every argument is a literal it can be worked out from
+    [[nodiscard]] std::optional<operand> fold_literals(operation, type_ptr result_type,
+                                                       const std::vector<operand> & args);
+    static void check_condition(const operand &);
+    // A while loop, or a for loop after its initial statement
+    void compile_loop(const ast::expression & cond, const ast::statement & body,
+                      const ast::statement * increment);
+
+    // Block construction. Code always goes to the end of the current block.
+
+    [[nodiscard]] uint32_t new_block();
+    void emit(instruction);
+    void jump_to(uint32_t block);
+    void branch(const operand & cond, uint32_t true_block, uint32_t false_block);
+
+    // SSA construction as in Braun et al., "Simple and Efficient Construction of Static Single
+    // Assignment Form". Variables are read through the blocks before, adding phis where paths
+    // join. A block is sealed once all of its predecessors are known.
+
+    void write_variable(const std::string & id, uint32_t block, operand value);
+    [[nodiscard]] operand read_variable(const std::string & id, uint32_t block);
+    [[nodiscard]] operand read_variable_recursive(const std::string & id, uint32_t block);
+    [[nodiscard]] operand add_phi(const std::string & id, uint32_t block);
+    void add_phi_operands(const std::string & id, uint32_t block, const operand & phi);
+    void seal_block(uint32_t block);
+
+    // Ends the function's last block, then drops unreachable blocks and phis that choose
+    // between a single value
+    void finish_function();
+    static void remove_unreachable_blocks(function_details &);
+    static void remove_trivial_phis(function_details &);
+    // Joins each block ending in a jump to the block it jumps to, when nothing else jumps there
+    static void merge_blocks(function_details &);
+    // Replaces every use of each value with its entry in replacements, when it has one
+    static void replace_uses(function_details &,
+                             const std::vector<std::optional<operand>> & replacements);
+    [[nodiscard]] uint32_t instruction_count() const;
+    // Appends callee's body to output, with the call's arguments in place of the parameters.
+    // The callee's other values are added to caller.
+    static void splice(const function_details & callee, const instruction & call,
+                       function_details & caller, std::vector<instruction> & output);
 
     std::map<std::string, function_details> functions;
     std::string current_func_name;
+    std::map<std::string, type_ptr> structs;
+
+    // State of the function being built
+    struct function_builder {
+        uint32_t block = 0;
+        // Each variable's value at the end of each block it was written or read in
+        std::map<std::pair<std::string, uint32_t>, operand> definitions;
+        std::map<std::string, type_ptr> variables;
+        std::set<uint32_t> sealed;
+        // Phis waiting for their block to be sealed, by block
+        std::map<uint32_t, std::vector<std::pair<std::string, operand>>> incomplete_phis;
+    } builder;
+
+    std::vector<std::pair<std::string, module_pass>> passes;
 
     std::string filename;
-    int temp_num = 0;
     uint32_t func_num = 0;
 
     friend std::ostream & operator<<(std::ostream &, const ir::modul &);
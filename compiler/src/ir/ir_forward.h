@@ -12,8 +12,6 @@ enum class operation {
     mul,
     div,
     rem,
-    boolean_and,
-    boolean_or,
     less_eq,
     less,
     greater_eq,
@@ -29,9 +27,14 @@ enum class operation {
     boolean_not,
     negation,
     bit_not,
+    // Terminators, besides ret
+    branch,
+    jump,
+    phi,
 };
 
 struct instruction;
+struct basic_block;
 struct operand;
 struct modul;
 
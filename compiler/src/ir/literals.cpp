@@ -0,0 +1,32 @@
+#include "literals.h"
+
+namespace ir {
+
+std::optional<uint32_t> integer_value(const std::string & text) {
+    const auto hex = text.size() > 2 and text[0] == '0' and text[1] == 'x';
+    const uint64_t base = hex ? 16 : 10;
+    uint64_t value = 0;
+    auto digits = 0u;
+    for (auto iter = text.begin() + (hex ? 2 : 0); iter != text.end(); ++iter) {
+        const auto c = *iter;
+        if (c == '_') continue;
+
+        uint64_t digit;
+        if (c >= '0' and c <= '9')
+            digit = static_cast<uint64_t>(c - '0');
+        else if (hex and c >= 'a' and c <= 'f')
+            digit = static_cast<uint64_t>(c - 'a' + 10);
+        else if (hex and c >= 'A' and c <= 'F')
+            digit = static_cast<uint64_t>(c - 'A' + 10);
+        else
+            return std::nullopt;
+
+        value = value * base + digit;
+        if (value > UINT32_MAX) return std::nullopt;
+        ++digits;
+    }
+    if (digits == 0) return std::nullopt;
+    return static_cast<uint32_t>(value);
+}
+
+} // namespace ir
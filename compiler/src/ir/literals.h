@@ -0,0 +1,16 @@
+#ifndef LITERALS_H
+#define LITERALS_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace ir {
+
+// The value of an integer literal as the lexer accepts it, decimal or 0x hex with _ anywhere
+// among the digits. Nothing when it isn't one or doesn't fit in 32 bits.
+[[nodiscard]] std::optional<uint32_t> integer_value(const std::string & text);
+
+} // namespace ir
+
+#endif
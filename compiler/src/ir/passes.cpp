@@ -0,0 +1,59 @@
+#include "ir.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace ir {
+
+void modul::add_pass(std::string name, module_pass pass) {
+    passes.emplace_back(std::move(name), std::move(pass));
+}
+
+void modul::add_pass(std::string name, function_pass pass) {
+    add_pass(std::move(name), [pass](modul & mod) {
+        for (auto & iter : mod.functions) pass(iter.second);
+    });
+}
+
+void modul::run_passes(bool stats) {
+    for (auto & [name, pass] : passes) {
+        if (not stats) {
+            pass(*this);
+            continue;
+        }
+
+        const auto before = instruction_count();
+        const auto start_time = std::chrono::steady_clock::now();
+        pass(*this);
+        const auto elapsed = std::chrono::steady_clock::now() - start_time;
+        const auto after = instruction_count();
+
+        // Inlining can grow the code
+        if (after > before)
+            std::cout << "Pass " << name << " added " << after - before << " to " << before;
+        else
+            std::cout << "Pass " << name << " removed " << before - after << " of " << before;
+        std::cout << " instructions in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+                  << " us" << std::endl;
+    }
+}
+
+uint32_t modul::instruction_count() const {
+    uint32_t count = 0;
+    for (auto & iter : functions)
+        for (auto & block : iter.second.blocks)
+            count += static_cast<uint32_t>(block.instructions.size());
+    return count;
+}
+
+void modul::replace_uses(function_details & func,
+                         const std::vector<std::optional<operand>> & replacements) {
+    for (auto & block : func.blocks)
+        for (auto & inst : block.instructions)
+            for (auto & arg : inst.args)
+                if (arg.id < replacements.size() and replacements[arg.id].has_value())
+                    arg = *replacements[arg.id];
+}
+
+} // namespace ir
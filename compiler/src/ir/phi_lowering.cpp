@@ -0,0 +1,34 @@
+#include "ir.h"
+
+#include <cassert>
+#include <iterator>
+
+namespace ir {
+
+void modul::lower_phis() {
+    for (auto & iter : functions) {
+        auto & blocks = iter.second.blocks;
+        // The copies to add to the end of each block. A block can be its own predecessor, so
+        // they are only added once every phi is gone.
+        std::vector<std::vector<instruction>> copies(blocks.size());
+        for (auto & block : blocks) {
+            for (auto & inst : block.instructions) {
+                if (inst.op != operation::phi) break;
+                const auto through = iter.second.add_temporary(inst.result->typ);
+                for (auto arg = 0u; arg < inst.args.size(); ++arg)
+                    copies[inst.targets[arg]].push_back(
+                        {operation::assign, {std::move(inst.args[arg])}, through});
+                inst = instruction{operation::assign, {through}, inst.result};
+            }
+        }
+
+        for (auto block = 0u; block < blocks.size(); ++block) {
+            auto & code = blocks[block].instructions;
+            assert(copies[block].empty() or code.back().terminator());
+            code.insert(code.end() - 1, std::make_move_iterator(copies[block].begin()),
+                        std::make_move_iterator(copies[block].end()));
+        }
+    }
+}
+
+} // namespace ir
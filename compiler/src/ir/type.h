@@ -1,8 +1,12 @@
 #ifndef TYPE_H
 #define TYPE_H
 
+#include <cstddef>
 #include <iosfwd>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace ir {
@@ -19,12 +23,14 @@ class type {
 
     virtual void print(std::ostream &) const = 0;
 };
-using type_ptr = std::shared_ptr<type>;
+// Every type is made once and lives as long as the process, so types are equal exactly when
+// their pointers are
+using type_ptr = const type *;
 
 class unit_type final : public type {
-    public:
+  public:
     bool composite() const noexcept final { return false; }
-    static type_ptr instance;
+    static const type_ptr instance;
 
   private:
     void print(std::ostream &) const final;
@@ -33,7 +39,7 @@ class unit_type final : public type {
 class string_type final : public type {
   public:
     bool composite() const noexcept final { return false; }
-    static type_ptr instance;
+    static const type_ptr instance;
 
   private:
     void print(std::ostream &) const final;
@@ -42,7 +48,7 @@ class string_type final : public type {
 class integer_type final : public type {
   public:
     bool composite() const noexcept final { return false; }
-    static type_ptr instance;
+    static const type_ptr instance;
 
   private:
     void print(std::ostream &) const final;
@@ -51,7 +57,7 @@ class integer_type final : public type {
 class floating_type final : public type {
   public:
     bool composite() const noexcept final { return false; }
-    static type_ptr instance;
+    static const type_ptr instance;
 
   private:
     void print(std::ostream &) const final;
@@ -60,7 +66,7 @@ class floating_type final : public type {
 class boolean_type final : public type {
   public:
     bool composite() const noexcept final { return false; }
-    static type_ptr instance;
+    static const type_ptr instance;
 
   private:
     void print(std::ostream &) const final;
@@ -69,19 +75,20 @@ class boolean_type final : public type {
 class character_type final : public type {
   public:
     bool composite() const noexcept final { return false; }
-    static type_ptr instance;
+    static const type_ptr instance;
 
   private:
     void print(std::ostream &) const final;
 };
 
+// Made through type_context
 class func_type final : public type {
   public:
     bool composite() const noexcept final { return true; }
 
-    explicit func_type(std::vector<type_ptr> && args = {}, type_ptr ret = nullptr)
+    func_type(std::vector<type_ptr> && args, type_ptr ret)
         : arg_types{std::move(args)}
-        , ret_type{std::move(ret)} {}
+        , ret_type{ret} {}
 
   private:
     void print(std::ostream &) const final;
@@ -90,6 +97,54 @@ class func_type final : public type {
     type_ptr ret_type;
 };
 
+// Made through type_context
+class struct_type final : public type {
+  public:
+    bool composite() const noexcept final { return true; }
+
+    using field = std::pair<std::string, type_ptr>;
+
+    struct_type(std::string && name, std::vector<field> && fields)
+        : name{std::move(name)}
+        , fields{std::move(fields)} {}
+
+  private:
+    void print(std::ostream &) const final;
+
+    std::string name;
+    std::vector<field> fields;
+};
+
+// Owns the function and struct types, making each structurally distinct one only once
+class type_context final {
+  public:
+    [[nodiscard]] static type_context & global();
+
+    type_context(const type_context &) = delete;
+    type_context & operator=(const type_context &) = delete;
+
+    type_context(type_context &&) noexcept = delete;
+    type_context & operator=(type_context &&) noexcept = delete;
+
+    ~type_context() noexcept = default;
+
+    [[nodiscard]] type_ptr function(std::vector<type_ptr> args, type_ptr ret);
+    [[nodiscard]] type_ptr structure(std::string name, std::vector<struct_type::field> fields);
+
+  private:
+    type_context() = default;
+
+    using func_key = std::pair<std::vector<type_ptr>, type_ptr>;
+    using struct_key = std::pair<std::string, std::vector<struct_type::field>>;
+    struct key_hash {
+        [[nodiscard]] size_t operator()(const func_key &) const noexcept;
+        [[nodiscard]] size_t operator()(const struct_key &) const noexcept;
+    };
+
+    std::unordered_map<func_key, std::unique_ptr<func_type>, key_hash> functions;
+    std::unordered_map<struct_key, std::unique_ptr<struct_type>, key_hash> structs;
+};
+
 type_ptr ast_to_ir_type(const std::string &);
 
 } // namespace ir
@@ -0,0 +1,87 @@
+#include "dominators.h"
+#include "ir.h"
+
+#include <algorithm>
+#include <map>
+
+namespace ir {
+
+namespace {
+bool commutative(operation op) {
+    switch (op) {
+    case operation::add:
+    case operation::mul:
+    case operation::equal:
+    case operation::not_equal:
+    case operation::bit_and:
+    case operation::bit_or:
+    case operation::bit_xor:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// What the instruction computes: its op and argument values. Phis choose by the way into their
+// block, so they are only the same as another phi of the same block.
+std::vector<uint32_t> expression_of(const instruction & inst, uint32_t block) {
+    std::vector<uint32_t> key{static_cast<uint32_t>(inst.op)};
+    if (inst.op == operation::phi) key.push_back(block);
+    const auto args_start = key.size();
+    for (auto & arg : inst.args) key.push_back(arg.id);
+    if (commutative(inst.op)) std::sort(key.begin() + args_start, key.end());
+    key.insert(key.end(), inst.targets.begin(), inst.targets.end());
+    return key;
+}
+} // namespace
+
+void modul::number_values(function_details & func) {
+    const dominator_tree dominators{func};
+    std::vector<std::optional<operand>> replacements(func.value_count());
+
+    // What the blocks dominating the one being visited compute, and which block added each
+    using expressions = std::map<std::vector<uint32_t>, operand>;
+    expressions available;
+    std::vector<std::vector<expressions::iterator>> added(func.blocks.size());
+
+    // A block's expressions are available to its children in the tree, and dropped once they
+    // are done
+    std::vector<std::pair<uint32_t, bool>> to_visit{{0, false}};
+    while (not to_visit.empty()) {
+        auto [block, leaving] = to_visit.back();
+        to_visit.pop_back();
+        if (leaving) {
+            for (auto iter : added[block]) available.erase(iter);
+            continue;
+        }
+        to_visit.emplace_back(block, true);
+        for (auto child : dominators.children(block)) to_visit.emplace_back(child, false);
+
+        auto & code = func.blocks[block].instructions;
+        std::vector<instruction> kept;
+        kept.reserve(code.size());
+        for (auto & inst : code) {
+            // Arguments from dominating blocks already have their final values
+            for (auto & arg : inst.args)
+                if (replacements[arg.id].has_value()) arg = *replacements[arg.id];
+            if (inst.side_effects() or not inst.result.has_value()) {
+                kept.push_back(std::move(inst));
+                continue;
+            }
+            auto [iter, inserted] = available.emplace(expression_of(inst, block), *inst.result);
+            if (not inserted) {
+                replacements[inst.result->id] = iter->second;
+                continue;
+            }
+            added[block].push_back(iter);
+            kept.push_back(std::move(inst));
+        }
+        code = std::move(kept);
+    }
+
+    // Phis can use values from blocks visited after them
+    replace_uses(func, replacements);
+    remove_trivial_phis(func);
+}
+
+} // namespace ir
@@ -71,9 +71,9 @@ A sequence of pointers allows polymorphism, otherwise there is none.
 %nterm <lval> lvalue
 %nterm <id_with_type> typed_id
 %nterm <statements> stmt_list
-%nterm <arguments> args
+%nterm <arguments> args arg_list
 %nterm <typed_ids> param_list parameters struct_items
-%nterm <field_assignments> field_assignments
+%nterm <field_assignments> field_assignments field_list
 
 %precedence then
 %precedence t_else
@@ -106,7 +106,7 @@ struct_decl: t_struct id lbrace struct_items rbrace { $$ = new struct_decl{$2, s
            ;
 
 struct_items: %empty             { $$ = new std::vector<typed_id>; }
-    | typed_id semi struct_items { $$ = $3; $$->push_back(std::move(*$1)); delete $1; }
+    | struct_items typed_id semi { $$ = $1; $$->push_back(std::move(*$2)); delete $2; }
     ;
 
 function: func id param_list opt_typed function_body
@@ -151,7 +151,7 @@ block_stmt: lbrace stmt_list rbrace { $$ = new block_stmt{std::move(*$2)}; delet
           ;
 
 stmt_list: %empty { $$ = new std::vector<statement*>; }
-    | stmt stmt_list { $$ = $2; $$->push_back($1); }
+    | stmt_list stmt { $$ = $1; $$->push_back($2); }
     ;
 
 return_stmt: t_return { $$ = new return_stmt; }
@@ -197,9 +197,12 @@ lvalue: id          { $$ = new lvalue{$1}; }
 function_call: id "(" args ")" { $$ = new function_call{$1, std::move(*$3)}; delete $3; }
              ;
 
-args: %empty        { $$ = new std::vector<expression*>{}; }
-    | expr          { $$ = new std::vector{$1}; }
-    | expr "," args { $$ = $3; $$->push_back($1); }
+args: %empty { $$ = new std::vector<expression*>{}; }
+    | arg_list
+    ;
+
+arg_list: expr          { $$ = new std::vector{$1}; }
+    | arg_list "," expr { $$ = $1; $$->push_back($3); }
     ;
 
 expr: primitive
@@ -217,8 +220,8 @@ expr: primitive
     | expr "!=" expr                        { $$ = new binary_expr{$1, binary_operation::not_equal, $3}; }
     | expr "&" expr                         { $$ = new binary_expr{$1, binary_operation::bit_and, $3}; }
     | expr "|" expr                         { $$ = new binary_expr{$1, binary_operation::bit_or, $3}; }
-    | expr "<<" expr                        { $$ = new binary_expr{$1, binary_operation::bit_right, $3}; }
-    | expr ">>" expr                        { $$ = new binary_expr{$1, binary_operation::bit_left, $3}; }
+    | expr "<<" expr                        { $$ = new binary_expr{$1, binary_operation::bit_left, $3}; }
+    | expr ">>" expr                        { $$ = new binary_expr{$1, binary_operation::bit_right, $3}; }
     | expr "^" expr                         { $$ = new binary_expr{$1, binary_operation::bit_xor, $3}; }
     | expr "%" expr                         { $$ = new binary_expr{$1, binary_operation::rem, $3}; }
     | "!" expr                              { $$ = new unary_expr{unary_operation::boolean_not, $2}; }
@@ -237,9 +240,12 @@ primitive: literal
 struct_creation: id lbrace field_assignments rbrace { $$ = new struct_init{$1, std::move(*$3)}; delete $3; }
                ;
 
-field_assignments: %empty               { $$ = new std::vector<field_assignment>; }
-    | id "=" expr                       { $$ = new std::vector<field_assignment>; $$->emplace_back($1, $3); }
-    | id "=" expr "," field_assignments { $$ = $5; $$->emplace_back($1, $3); }
+field_assignments: %empty { $$ = new std::vector<field_assignment>; }
+    | field_list
+    ;
+
+field_list: id "=" expr          { $$ = new std::vector<field_assignment>; $$->emplace_back($1, $3); }
+    | field_list "," id "=" expr { $$ = $1; $$->emplace_back($3, $5); }
     ;
 
 assign_op: "=" { $$ = assignment_operation::assign; }
@@ -7,21 +7,58 @@
 #include <cassert>
 #include <cstdio>
 #include <iostream>
+#include <string_view>
 
 std::unique_ptr<ast::modul> current_module;
 
 int main(const int arg_count, const char * const * const args) {
 
+    // --no-propagate, --no-inline, --no-gvn, --no-dce and --no-peephole turn those passes off,
+    // --pass-stats prints what each pass removed and how long it took, --layout-profile=F lays
+    // functions out by the VM profile in F, any other argument is the input file
+    auto propagate_constants = true;
+    auto inline_calls = true;
+    auto number_values = true;
+    auto remove_dead_code = true;
+    auto pass_stats = false;
+    bytecode::peephole_options peephole;
+    bytecode::layout_profile layout;
+    const char * input_name = nullptr;
+    for (auto i = 1; i < arg_count; ++i) {
+        if (std::string_view arg{args[i]}; arg == "--no-propagate") {
+            propagate_constants = false;
+        } else if (arg == "--no-inline") {
+            inline_calls = false;
+        } else if (arg == "--no-gvn") {
+            number_values = false;
+        } else if (arg == "--no-dce") {
+            remove_dead_code = false;
+        } else if (arg == "--no-peephole") {
+            peephole = bytecode::peephole_options::none();
+        } else if (arg == "--pass-stats") {
+            pass_stats = true;
+        } else if (arg.substr(0, 17) == "--layout-profile=") {
+            auto path = std::string{arg.substr(17)};
+            auto read = bytecode::read_layout_profile(path);
+            if (not read.has_value()) {
+                std::cout << "Could not read layout profile " << path << std::endl;
+                exit(1);
+            }
+            layout = std::move(*read);
+        } else {
+            input_name = args[i];
+        }
+    }
+
     yyin = nullptr;
-    if (arg_count <= 1) {
+    if (input_name == nullptr) {
         // open stdin
 
         auto [open_module, input] = modul::open_stdin();
         yyin = input;
         current_module = std::move(open_module);
     } else {
-        // use the first arg as a input filename
-        auto [open_module, input_file] = modul::open_module(args[1]);
+        auto [open_module, input_file] = modul::open_module(input_name);
         if (input_file != nullptr) {
             yyin = input_file;
             current_module = std::move(open_module);
@@ -51,10 +88,18 @@ int main(const int arg_count, const char * const * const args) {
 
     ir::modul ir_modul{current_module->filename()};
     current_module->build(ir_modul);
+    // Propagating first leaves smaller functions to inline
+    if (propagate_constants)
+        ir_modul.add_pass("constant propagation", &ir::modul::propagate_constants);
+    if (inline_calls) ir_modul.add_pass("inlining", [](ir::modul & mod) { mod.inline_calls(); });
+    if (number_values) ir_modul.add_pass("value numbering", &ir::modul::number_values);
+    if (remove_dead_code) ir_modul.add_pass("dead code removal", &ir::modul::remove_dead_code);
+    ir_modul.run_passes(pass_stats);
 
     std::cout << ir_modul << std::endl;
 
-    bytecode::modul byte_modul{std::move(ir_modul)};
+    peephole.stats = pass_stats;
+    bytecode::modul byte_modul{std::move(ir_modul), peephole, std::move(layout)};
 
     auto output_filename = current_module->filename();
 
@@ -0,0 +1,43 @@
+# Compiles source in work_dir, then runs the binary with vm, failing unless every run exits
+# with exit_code and prints exactly what the expected file holds
+
+file(MAKE_DIRECTORY ${work_dir})
+get_filename_component(name ${source} NAME_WE)
+configure_file(${source} ${work_dir}/${name}.arturo COPYONLY)
+file(READ ${expected} expected_output)
+
+set(unoptimized --no-propagate --no-inline --no-gvn --no-dce --no-peephole)
+foreach(passes IN ITEMS optimized unoptimized)
+    # The compiler names its output after the source
+    execute_process(
+        COMMAND ${compiler} ${${passes}} ${name}.arturo
+        WORKING_DIRECTORY ${work_dir}
+        RESULT_VARIABLE result
+        OUTPUT_VARIABLE log
+        ERROR_VARIABLE log
+        )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Compiling ${name} ${passes} failed with ${result}:\n${log}")
+    endif()
+
+    foreach(mode IN ITEMS threaded --switch --interpret --jit --no-fuse)
+        set(mode_args ${mode})
+        if(mode STREQUAL threaded)
+            set(mode_args)
+        endif()
+        execute_process(
+            COMMAND ${vm} ${mode_args} ${name}.bin
+            WORKING_DIRECTORY ${work_dir}
+            RESULT_VARIABLE result
+            OUTPUT_VARIABLE output
+            ERROR_VARIABLE errors
+            )
+        if(NOT result EQUAL exit_code)
+            message(FATAL_ERROR "${name} ${passes} ${mode} exited with ${result}:\n${errors}")
+        endif()
+        if(NOT output STREQUAL expected_output)
+            message(FATAL_ERROR "${name} ${passes} ${mode} printed\n${output}\ninstead of\n"
+                                "${expected_output}")
+        endif()
+    endforeach()
+endforeach()
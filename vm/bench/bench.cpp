@@ -0,0 +1,260 @@
+#include "interpreter/machine.h"
+#include "isa.h"
+#include "loader/decoded_text.h"
+#include "loader/image.h"
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using isa::opcode;
+using isa::reg;
+
+// How many times each workload repeats its pattern
+constexpr unsigned repeats = 10'000;
+
+uint32_t encode(opcode op, reg rd, reg rs, uint16_t imm) {
+    return static_cast<uint32_t>(op) << isa::opcode_shift | uint32_t{rd} << isa::rd_shift
+         | uint32_t{rs} << isa::rs1_shift | imm;
+}
+
+uint32_t encode_jump(opcode op, reg rd, uint32_t addr) {
+    return static_cast<uint32_t>(op) << isa::opcode_shift | uint32_t{rd} << isa::rd_shift
+         | ((addr >> 2) & isa::jump_mask);
+}
+
+uint32_t encode_syscall(reg rd, reg rs1, isa::syscall_func func) {
+    return static_cast<uint32_t>(opcode::syscall) << isa::opcode_shift
+         | uint32_t{rd} << isa::rd_shift | uint32_t{rs1} << isa::rs1_shift
+         | static_cast<uint32_t>(func);
+}
+
+uint16_t offset(int value) { return static_cast<uint16_t>(value); }
+
+// A generated guest program
+struct workload {
+    std::string name;
+    std::vector<uint32_t> text;
+    std::vector<uint32_t> data;
+    // Index in text of the first instruction to run
+    uint32_t entry = 0;
+};
+
+// Calls a tiny function the way the backend does: spill, pass an argument, jal, reload
+workload call_heavy() {
+    workload work{"call_heavy", {}, {}, 2};
+    work.text.push_back(encode(opcode::ori, reg::v0, reg::a0, 1));
+    work.text.push_back(encode(opcode::jr, reg::lr, reg::zero, 0));
+    for (auto i = 0u; i < repeats; ++i) {
+        work.text.push_back(encode(opcode::sw, reg::s0, reg::sp, offset(-4)));
+        work.text.push_back(encode(opcode::ori, reg::a0, reg::zero, static_cast<uint16_t>(i)));
+        work.text.push_back(encode_jump(opcode::jal, reg::lr, isa::text_start));
+        work.text.push_back(encode(opcode::lw, reg::s0, reg::sp, offset(-4)));
+    }
+    work.text.push_back(encode_syscall(reg::zero, reg::zero, isa::syscall_func::exit));
+    return work;
+}
+
+// Prints a short string over and over
+workload print_heavy() {
+    workload work{"print_heavy", {}, {}, 0};
+    // "bench\n", packed most significant byte first
+    work.data = {0x62656E63, 0x680A0000};
+    for (auto i = 0u; i < repeats; ++i) {
+        work.text.push_back(encode(opcode::ori, reg::a0, reg::zero, isa::data_start));
+        work.text.push_back(encode_syscall(reg::zero, reg::a0, isa::syscall_func::print));
+    }
+    work.text.push_back(encode_syscall(reg::zero, reg::zero, isa::syscall_func::exit));
+    return work;
+}
+
+// Stores and reloads words scattered over several pages of fresh memory
+workload load_store_heavy() {
+    workload work{"load_store_heavy", {}, {}, 0};
+    work.text.push_back(encode(opcode::lui, reg::s1, reg::zero, 0x1000));
+    for (auto i = 0u; i < repeats; ++i) {
+        auto addr = static_cast<uint16_t>((i * 4 * 1031) % 0x8000);
+        work.text.push_back(encode(opcode::sw, reg::a0, reg::s1, addr));
+        work.text.push_back(encode(opcode::lw, reg::a1, reg::s1, addr));
+        work.text.push_back(encode(opcode::ori, reg::a0, reg::a1, 1));
+    }
+    work.text.push_back(encode_syscall(reg::zero, reg::zero, isa::syscall_func::exit));
+    return work;
+}
+
+// Packs name most significant byte first, NUL terminated and padded to a whole word
+void pack_name(std::string_view name, std::vector<uint32_t> & output) {
+    for (auto i = 0u; i <= name.size(); i += 4) {
+        uint32_t packed = 0;
+        for (auto j = i; j < i + 4; ++j)
+            packed = packed << 8 | (j < name.size() ? static_cast<uint8_t>(name[j]) : 0u);
+        output.push_back(packed);
+    }
+}
+
+// Writes the workload as a .bin file and loads it like the VM does
+vm::image load(const workload & work) {
+    std::vector<uint32_t> table;
+    const auto table_size = [] {
+        std::vector<uint32_t> names;
+        pack_name(".data", names);
+        pack_name(".text", names);
+        return static_cast<uint32_t>((6 + names.size()) * sizeof(uint32_t));
+    }();
+    auto data_offset = isa::header_size + table_size;
+    auto data_length = static_cast<uint32_t>(work.data.size() * sizeof(uint32_t));
+    auto text_length = static_cast<uint32_t>(work.text.size() * sizeof(uint32_t));
+    table.insert(table.end(), {data_offset, data_length, isa::data_start});
+    pack_name(".data", table);
+    table.insert(table.end(), {data_offset + data_length, text_length, isa::text_start});
+    pack_name(".text", table);
+
+    std::vector<uint32_t> words{isa::text_start + work.entry * 4, isa::sp_start, table_size};
+    words.insert(words.end(), table.begin(), table.end());
+    words.insert(words.end(), work.data.begin(), work.data.end());
+    words.insert(words.end(), work.text.begin(), work.text.end());
+
+    const auto * tmp_dir = getenv("TMPDIR");
+    std::string path = std::string{tmp_dir != nullptr ? tmp_dir : "/tmp"} + "/arturo_bench_XXXXXX";
+    auto fd = mkstemp(path.data());
+    auto * output = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (output == nullptr) {
+        std::cout << "Could not create a temporary file for " << work.name << std::endl;
+        exit(1);
+    }
+    auto written = fwrite(isa::magic_bytes, 1, sizeof(isa::magic_bytes), output)
+                       == sizeof(isa::magic_bytes)
+               and fwrite(words.data(), sizeof(uint32_t), words.size(), output) == words.size();
+    if (fclose(output) != 0 or not written) {
+        std::cout << "Could not write " << path << std::endl;
+        exit(1);
+    }
+
+    // The mapping outlives the file
+    auto program = vm::image::load(path);
+    unlink(path.c_str());
+    return program;
+}
+
+long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct options {
+    unsigned warmup = 5;
+    unsigned iterations = 50;
+};
+
+// Runs the workload a few times to warm up, then times it over the iterations.
+// Guest output is discarded. Peak RSS covers the whole process so far.
+void bench(const workload & work, vm::dispatch mode, const options & opts, int null_fd,
+           bool last) {
+    auto program = load(work);
+    vm::machine_options machine_opts;
+    machine_opts.output_fd = null_fd;
+
+    // Count what a single run executes
+    vm::decoded_text profiled_text{program, vm::machine::threaded_labels(true)};
+    machine_opts.profile = true;
+    vm::machine profiled{program, profiled_text, machine_opts};
+    if (profiled.run(mode) != 0) {
+        std::cout << work.name << " failed" << std::endl;
+        exit(1);
+    }
+    const auto instructions = profiled.execution_profile()->instruction_count();
+    const auto dispatches = profiled.execution_profile()->dispatch_count();
+
+    machine_opts.profile = false;
+    vm::decoded_text text{program, vm::machine::threaded_labels()};
+    std::chrono::nanoseconds total{};
+    auto best = std::chrono::nanoseconds::max();
+    for (auto i = 0u; i < opts.warmup + opts.iterations; ++i) {
+        vm::machine machine{program, text, machine_opts};
+        auto start = std::chrono::steady_clock::now();
+        static_cast<void>(machine.run(mode));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if (i < opts.warmup) continue;
+        total += elapsed;
+        best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+    }
+
+    auto mean = static_cast<double>(total.count()) / opts.iterations;
+    std::cout << "    {\"name\": \"" << work.name << "\", \"dispatch\": \""
+              << (mode == vm::dispatch::threaded ? "threaded" : "switched")
+              << "\", \"instructions\": " << instructions << ", \"dispatches\": " << dispatches
+              << ", \"mean_ns\": " << static_cast<uint64_t>(mean)
+              << ", \"best_ns\": " << best.count()
+              << ", \"instructions_per_second\": "
+              << static_cast<uint64_t>(static_cast<double>(instructions) / mean * 1e9)
+              << ", \"ns_per_dispatch\": " << mean / static_cast<double>(dispatches)
+              << ", \"peak_rss_kb\": " << peak_rss_kb() << '}' << (last ? "\n" : ",\n");
+}
+
+// The N of --flag=N, or nothing when it isn't a number that fits
+std::optional<unsigned> parse_count(std::string_view value) {
+    unsigned count = 0;
+    const auto * end = value.data() + value.size();
+    auto [rest, error] = std::from_chars(value.data(), end, count);
+    if (error != std::errc{} or rest != end) return std::nullopt;
+    return count;
+}
+
+void usage(const char * name) {
+    std::cout << "Usage: " << name << " [options]\n"
+              << "  --warmup=N      untimed runs before measuring, default 5\n"
+              << "  --iterations=N  timed runs of each workload, default 50\n"
+              << "Interprets generated workloads and reports the timings as JSON." << std::endl;
+}
+
+} // namespace
+
+int main(const int arg_count, const char * const * const args) {
+    options opts;
+    for (auto i = 1; i < arg_count; ++i) {
+        std::string_view arg{args[i]};
+        std::optional<unsigned> count;
+        if (arg.substr(0, 9) == "--warmup=") {
+            count = parse_count(arg.substr(9));
+            if (count.has_value()) opts.warmup = *count;
+        } else if (arg.substr(0, 13) == "--iterations=") {
+            count = parse_count(arg.substr(13));
+            if (count.has_value()) opts.iterations = *count;
+        }
+        // The mean divides by the timed runs, so there has to be one
+        if (not count.has_value() or opts.iterations == 0) {
+            std::cout << "Invalid argument " << arg << '\n';
+            usage(args[0]);
+            exit(1);
+        }
+    }
+
+    auto null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0) {
+        std::cout << "Could not open /dev/null" << std::endl;
+        exit(1);
+    }
+
+    const std::vector<workload> workloads{call_heavy(), print_heavy(), load_store_heavy()};
+    std::cout << "{\n  \"warmup\": " << opts.warmup << ",\n  \"iterations\": " << opts.iterations
+              << ",\n  \"workloads\": [\n";
+    for (auto i = 0u; i < workloads.size(); ++i) {
+        bench(workloads[i], vm::dispatch::threaded, opts, null_fd, false);
+        bench(workloads[i], vm::dispatch::switched, opts, null_fd, i + 1 == workloads.size());
+    }
+    std::cout << "  ]\n}" << std::endl;
+
+    close(null_fd);
+}
@@ -0,0 +1,18 @@
+#include "fault.h"
+
+#include <iostream>
+
+namespace vm {
+
+guest_error::guest_error(const char * reason, uint32_t addr)
+    : std::runtime_error{reason}
+    , addr{addr} {}
+
+void guest_fault(const char * reason, uint32_t addr) { throw guest_error{reason, addr}; }
+
+std::ostream & operator<<(std::ostream & lhs, const guest_error & fault) {
+    return lhs << "Guest fault: " << fault.what() << " at 0x" << std::hex << fault.address()
+               << std::dec;
+}
+
+} // namespace vm
@@ -0,0 +1,30 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+
+namespace vm {
+
+// An unrecoverable guest error. It ends the guest that raised it, the VM reports it once it is
+// back on the thread that started the guest.
+class guest_error final : public std::runtime_error {
+  public:
+    guest_error(const char * reason, uint32_t addr);
+
+    [[nodiscard]] uint32_t address() const noexcept { return addr; }
+
+  private:
+    uint32_t addr;
+};
+
+// Stops the guest by throwing a guest_error
+[[noreturn]] void guest_fault(const char * reason, uint32_t addr);
+
+// Writes the fault the way the VM reports it
+std::ostream & operator<<(std::ostream &, const guest_error &);
+
+} // namespace vm
+
+#endif
@@ -0,0 +1,380 @@
+#include "machine.h"
+
+#include "fault.h"
+
+#include <iterator>
+
+namespace vm {
+
+machine::machine(const image & program, const decoded_text & text, const machine_options & options)
+    : output{options.output_fd, options.output}
+    , text{&text}
+    , entry{program.exec_start()} {
+
+    // Native code can't count, so profiling interprets everything
+    if (options.profile)
+        counters = std::make_unique<profile>(program, text);
+    else if (options.execution != tier::interpret_only and jit::supported())
+        compiler = std::make_unique<jit>(
+            text, options.execution == tier::jit_only ? 1 : jit::default_threshold);
+
+    for (auto & seg : program.segments()) {
+        if (seg.name == isa::symbol_table_segment) continue;
+        mem.map(seg.vm_addr, seg.words, seg.length, program.zero_copy());
+    }
+
+    registers[isa::sp] = program.sp_start();
+}
+
+int machine::run(dispatch mode) {
+    const auto profiled = counters != nullptr;
+    // The text only works with the threaded loop it was decoded for
+    const auto threaded = mode == dispatch::threaded and text->labels() != nullptr
+                      and text->labels() == threaded_labels(profiled);
+
+    try {
+        if (not profiled)
+            return threaded ? run_threaded<false>(this, nullptr) : run_switched<false>();
+
+        auto exit_code = threaded ? run_threaded<true>(this, nullptr) : run_switched<true>();
+        counters->finish();
+        return exit_code;
+    } catch (const guest_error &) {
+        // What the guest printed before the fault still goes out, ahead of the report
+        output.flush();
+        throw;
+    }
+}
+
+const void * const * machine::threaded_labels(bool profiled) {
+    const void * const * labels = nullptr;
+    static_cast<void>(profiled ? run_threaded<true>(nullptr, &labels)
+                               : run_threaded<false>(nullptr, &labels));
+    return labels;
+}
+
+template<bool profiled>
+int machine::run_threaded(machine * self, const void * const ** labels_out) {
+#if defined(__GNUC__)
+    // Each handler ends by jumping straight to the label stored in the next instruction,
+    // giving every handler its own indirect branch.
+    static const void * const labels[]{
+        &&op_r_type,      &&op_lui,        &&op_ori,           &&op_lw,
+        &&op_sw,          &&op_jal,        &&op_jr,            &&op_beq,
+        &&op_syscall,     &&op_illegal,    &&op_multi_store,   &&op_multi_move,
+        &&op_multi_load,  &&op_call_with_spill, &&op_end_of_text,
+    };
+    static_assert(std::size(labels) == static_cast<size_t>(handler::count));
+
+    if (self == nullptr) {
+        *labels_out = labels;
+        return 0;
+    }
+
+    auto & regs = self->registers;
+    [[maybe_unused]] auto * const counters = self->counters.get();
+    const auto * const base = self->text->begin();
+    const auto * ip = base + self->text->index_of(self->entry);
+    if constexpr (profiled) counters->enter(static_cast<uint32_t>(ip - base));
+    if (self->compiler != nullptr) ip = self->enter_function(ip);
+
+#define DISPATCH() goto * ip->label
+
+    DISPATCH();
+
+op_r_type:
+    if constexpr (profiled) counters->count(isa::opcode::r_type);
+    self->exec_r_type(*ip);
+    ++ip;
+    DISPATCH();
+op_lui:
+    if constexpr (profiled) counters->count(isa::opcode::lui);
+    self->set(ip->rd, ip->imm);
+    ++ip;
+    DISPATCH();
+op_ori:
+    if constexpr (profiled) counters->count(isa::opcode::ori);
+    self->set(ip->rd, regs[ip->rs1] | ip->imm);
+    ++ip;
+    DISPATCH();
+op_lw:
+    if constexpr (profiled) counters->count(isa::opcode::lw);
+    self->set(ip->rd, self->mem.load_word(regs[ip->rs1] + ip->imm));
+    ++ip;
+    DISPATCH();
+op_sw:
+    if constexpr (profiled) counters->count(isa::opcode::sw);
+    self->mem.store_word(regs[ip->rs1] + ip->imm, regs[ip->rd]);
+    ++ip;
+    DISPATCH();
+op_jal:
+    if constexpr (profiled) {
+        counters->count(isa::opcode::jal);
+        ip->rd == isa::zero ? counters->jump(ip->imm) : counters->enter(ip->imm);
+    }
+    self->set(ip->rd, self->text->address_of(ip + 1));
+    ip = base + ip->imm;
+    if (self->compiler != nullptr) ip = self->enter_function(ip);
+    DISPATCH();
+op_jr:
+    if constexpr (profiled) {
+        counters->count(isa::opcode::jr);
+        counters->leave();
+    }
+    ip = self->jump_register(*ip);
+    DISPATCH();
+op_beq:
+    if constexpr (profiled) counters->count(isa::opcode::beq);
+    ip = regs[ip->rd] == regs[ip->rs1] ? base + ip->imm : ip + 1;
+    DISPATCH();
+op_syscall:
+    if constexpr (profiled) counters->count(isa::opcode::syscall);
+    if (auto exit_code = self->exec_syscall(*ip)) return *exit_code;
+    ++ip;
+    DISPATCH();
+op_multi_store:
+op_multi_move:
+op_multi_load : {
+    const auto & seq = self->text->sequence(*ip);
+    if constexpr (profiled) counters->count(seq);
+    self->exec_fused(seq);
+    ip += seq.length;
+    DISPATCH();
+}
+op_call_with_spill : {
+    const auto & seq = self->text->sequence(*ip);
+    if constexpr (profiled) {
+        counters->count(seq);
+        counters->count(isa::opcode::jal);
+        seq.link == isa::zero ? counters->jump(seq.call_target) : counters->enter(seq.call_target);
+    }
+    self->exec_fused(seq);
+    self->set(seq.link, self->text->address_of(ip + seq.length));
+    ip = base + seq.call_target;
+    if (self->compiler != nullptr) ip = self->enter_function(ip);
+    DISPATCH();
+}
+op_illegal:
+    self->illegal_instruction(*ip);
+op_end_of_text:
+    self->end_of_text(*ip);
+
+#undef DISPATCH
+#else
+    if (self == nullptr) {
+        *labels_out = nullptr;
+        return 0;
+    }
+    return self->run_switched<profiled>();
+#endif
+}
+
+template<bool profiled>
+int machine::run_switched() {
+    const auto * const base = text->begin();
+    const auto * ip = base + text->index_of(entry);
+    if constexpr (profiled) counters->enter(static_cast<uint32_t>(ip - base));
+    if (compiler != nullptr) ip = enter_function(ip);
+    while (true) {
+        switch (ip->kind) {
+        case handler::r_type:
+            if constexpr (profiled) counters->count(isa::opcode::r_type);
+            exec_r_type(*ip);
+            ++ip;
+            break;
+        case handler::lui:
+            if constexpr (profiled) counters->count(isa::opcode::lui);
+            set(ip->rd, ip->imm);
+            ++ip;
+            break;
+        case handler::ori:
+            if constexpr (profiled) counters->count(isa::opcode::ori);
+            set(ip->rd, registers[ip->rs1] | ip->imm);
+            ++ip;
+            break;
+        case handler::lw:
+            if constexpr (profiled) counters->count(isa::opcode::lw);
+            set(ip->rd, mem.load_word(registers[ip->rs1] + ip->imm));
+            ++ip;
+            break;
+        case handler::sw:
+            if constexpr (profiled) counters->count(isa::opcode::sw);
+            mem.store_word(registers[ip->rs1] + ip->imm, registers[ip->rd]);
+            ++ip;
+            break;
+        case handler::jal:
+            if constexpr (profiled) {
+                counters->count(isa::opcode::jal);
+                ip->rd == isa::zero ? counters->jump(ip->imm) : counters->enter(ip->imm);
+            }
+            set(ip->rd, text->address_of(ip + 1));
+            ip = base + ip->imm;
+            if (compiler != nullptr) ip = enter_function(ip);
+            break;
+        case handler::jr:
+            if constexpr (profiled) {
+                counters->count(isa::opcode::jr);
+                counters->leave();
+            }
+            ip = jump_register(*ip);
+            break;
+        case handler::beq:
+            if constexpr (profiled) counters->count(isa::opcode::beq);
+            ip = registers[ip->rd] == registers[ip->rs1] ? base + ip->imm : ip + 1;
+            break;
+        case handler::syscall:
+            if constexpr (profiled) counters->count(isa::opcode::syscall);
+            if (auto exit_code = exec_syscall(*ip)) return *exit_code;
+            ++ip;
+            break;
+        case handler::multi_store:
+        case handler::multi_move:
+        case handler::multi_load: {
+            const auto & seq = text->sequence(*ip);
+            if constexpr (profiled) counters->count(seq);
+            exec_fused(seq);
+            ip += seq.length;
+        } break;
+        case handler::call_with_spill: {
+            const auto & seq = text->sequence(*ip);
+            if constexpr (profiled) {
+                counters->count(seq);
+                counters->count(isa::opcode::jal);
+                seq.link == isa::zero ? counters->jump(seq.call_target)
+                                      : counters->enter(seq.call_target);
+            }
+            exec_fused(seq);
+            set(seq.link, text->address_of(ip + seq.length));
+            ip = base + seq.call_target;
+            if (compiler != nullptr) ip = enter_function(ip);
+        } break;
+        case handler::illegal:
+        case handler::count:
+            illegal_instruction(*ip);
+        case handler::end_of_text:
+            end_of_text(*ip);
+        }
+    }
+}
+
+const decoded_instruction * machine::enter_function(const decoded_instruction * target) {
+    const auto * const base = text->begin();
+    if (auto native = compiler->enter(static_cast<uint32_t>(target - base)))
+        return base + jit::run(native, registers.data(), &mem);
+    return target;
+}
+
+const decoded_instruction * machine::jump_register(const decoded_instruction & inst) const {
+    auto target = registers[inst.rd];
+    auto index = text->index_of(target);
+    if (index == text->size()) guest_fault("jump outside of .text", target);
+    return text->begin() + index;
+}
+
+void machine::exec_r_type(const decoded_instruction & inst) {
+    using func = isa::r_type_func_num;
+    const auto lhs = registers[inst.rs1];
+    const auto rhs = registers[inst.rs2];
+    const auto signed_lhs = static_cast<int32_t>(lhs);
+    const auto signed_rhs = static_cast<int32_t>(rhs);
+    const auto op = static_cast<func>(inst.imm & isa::func_mask);
+    uint32_t result;
+    switch (op) {
+    case func::add:
+        result = lhs + rhs;
+        break;
+    case func::sub:
+        result = lhs - rhs;
+        break;
+    case func::mul:
+        result = lhs * rhs;
+        break;
+    case func::div:
+    case func::rem:
+        if (rhs == 0) guest_fault("division by zero", text->address_of(&inst));
+        // The one quotient that doesn't fit wraps around
+        if (signed_lhs == INT32_MIN and signed_rhs == -1)
+            result = op == func::div ? lhs : 0;
+        else if (op == func::div)
+            result = static_cast<uint32_t>(signed_lhs / signed_rhs);
+        else
+            result = static_cast<uint32_t>(signed_lhs % signed_rhs);
+        break;
+    case func::bit_and:
+        result = lhs & rhs;
+        break;
+    case func::bit_or:
+        result = lhs | rhs;
+        break;
+    case func::bit_xor:
+        result = lhs ^ rhs;
+        break;
+    case func::bit_nor:
+        result = ~(lhs | rhs);
+        break;
+    case func::shift_left:
+        result = lhs << (rhs & 31);
+        break;
+    case func::shift_right:
+        result = static_cast<uint32_t>(signed_lhs >> (rhs & 31));
+        break;
+    case func::less:
+        result = signed_lhs < signed_rhs;
+        break;
+    case func::less_eq:
+        result = signed_lhs <= signed_rhs;
+        break;
+    case func::equal:
+        result = lhs == rhs;
+        break;
+    case func::not_equal:
+        result = lhs != rhs;
+        break;
+    default:
+        illegal_instruction(inst);
+    }
+    set(inst.rd, result);
+}
+
+void machine::exec_fused(const fused_sequence & seq) {
+    const auto * step = text->steps_of(seq);
+    for (auto i = 0u; i < seq.stores; ++i, ++step)
+        mem.store_word(registers[step->rs] + step->imm, registers[step->rd]);
+    for (auto i = 0u; i < seq.moves; ++i, ++step) set(step->rd, registers[step->rs] | step->imm);
+    for (auto i = 0u; i < seq.loads; ++i, ++step)
+        set(step->rd, mem.load_word(registers[step->rs] + step->imm));
+}
+
+std::optional<int> machine::exec_syscall(const decoded_instruction & inst) {
+    switch (static_cast<isa::syscall_func>(inst.imm & isa::func_mask)) {
+    case isa::syscall_func::exit:
+        output.flush();
+        return static_cast<int>(registers[inst.rd]);
+    case isa::syscall_func::print: {
+        // rs1 holds the address of a NUL terminated string
+        print_scratch.clear();
+        for (auto addr = registers[inst.rs1];; ++addr) {
+            auto c = mem.load_byte(addr);
+            if (c == 0) break;
+            print_scratch.push_back(static_cast<char>(c));
+        }
+        output.append(print_scratch.data(), print_scratch.size());
+    } break;
+    case isa::syscall_func::flush:
+        output.flush();
+        break;
+    default:
+        guest_fault("unknown syscall", inst.imm & isa::func_mask);
+    }
+    return std::nullopt;
+}
+
+void machine::illegal_instruction(const decoded_instruction & inst) const {
+    guest_fault("illegal instruction", text->address_of(&inst));
+}
+
+void machine::end_of_text(const decoded_instruction & inst) const {
+    guest_fault("pc outside of .text", text->address_of(&inst));
+}
+
+} // namespace vm
@@ -0,0 +1,100 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "io/output_buffer.h"
+#include "isa.h"
+#include "jit/jit.h"
+#include "loader/decoded_text.h"
+#include "loader/image.h"
+#include "memory/memory.h"
+#include "profile.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unistd.h>
+
+namespace vm {
+
+enum class dispatch {
+    // Jump straight from handler to handler, falls back to switched when unsupported
+    threaded,
+    // A plain switch in a loop
+    switched,
+};
+
+struct machine_options {
+    tier execution = tier::interpret_only;
+    output_buffer::mode output = output_buffer::mode::buffered;
+    // Where the guest's prints go
+    int output_fd = STDOUT_FILENO;
+    // Count instructions and calls, this disables the JIT
+    bool profile = false;
+};
+
+class machine final {
+  public:
+    machine(const image &, const decoded_text &, const machine_options & = {});
+
+    machine(const machine &) = delete;
+    machine & operator=(const machine &) = delete;
+
+    machine(machine &&) noexcept = default;
+    machine & operator=(machine &&) noexcept = default;
+
+    ~machine() noexcept = default;
+
+    // Runs the program until it exits, returning the exit code. A guest_error is thrown on
+    // once the output is flushed.
+    [[nodiscard]] int run(dispatch);
+
+    // The threaded loop's label for each handler, or null when it is unsupported.
+    // The profiled loop has its own labels, so the text must be decoded for the right one.
+    [[nodiscard]] static const void * const * threaded_labels(bool profiled = false);
+
+    // Null unless profiling
+    [[nodiscard]] const profile * execution_profile() const noexcept { return counters.get(); }
+
+  private:
+    // The loops are specialized on profiled, so counting costs nothing when it is off.
+    // When self is null, only stores the handler labels in labels_out
+    template<bool profiled>
+    [[nodiscard]] static int run_threaded(machine * self, const void * const ** labels_out);
+    template<bool profiled>
+    [[nodiscard]] int run_switched();
+
+    void set(isa::reg reg, uint32_t value) {
+        registers[reg] = value;
+        registers[isa::zero] = 0;
+    }
+
+    // Runs native code for the function at target when there is some
+    [[nodiscard]] const decoded_instruction * enter_function(const decoded_instruction * target);
+    [[nodiscard]] const decoded_instruction * jump_register(const decoded_instruction &) const;
+    void exec_r_type(const decoded_instruction &);
+    void exec_fused(const fused_sequence &);
+    [[nodiscard]] std::optional<int> exec_syscall(const decoded_instruction &);
+
+    [[noreturn]] void illegal_instruction(const decoded_instruction &) const;
+    [[noreturn]] void end_of_text(const decoded_instruction &) const;
+
+    std::array<uint32_t, isa::register_count> registers{};
+    memory mem;
+    output_buffer output;
+    // Reused by print to gather a string out of guest memory
+    std::string print_scratch;
+
+    const decoded_text * text;
+    uint32_t entry;
+
+    // Null when interpreting only
+    std::unique_ptr<jit> compiler;
+    // Null unless profiling
+    std::unique_ptr<profile> counters;
+};
+
+} // namespace vm
+
+#endif
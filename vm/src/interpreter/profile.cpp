@@ -0,0 +1,56 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <ostream>
+
+namespace vm {
+
+profile::profile(const image & program, const decoded_text & text)
+    : text{&text}
+    , symbols{program.symbols()} {}
+
+void profile::write_json(std::ostream & output) const {
+    output << "{\n  \"instructions\": " << instructions
+           << ",\n  \"dispatches\": " << dispatch_count() << ",\n  \"opcodes\": {";
+    auto first = true;
+    for (auto i = 0u; i < isa::opcode_count; ++i) {
+        if (opcode_counts[i] == 0) continue;
+        output << (first ? "\n" : ",\n") << "    \""
+               << isa::opcode_name(static_cast<isa::opcode>(i)) << "\": " << opcode_counts[i];
+        first = false;
+    }
+    output << "\n  },\n  \"functions\": [";
+
+    // Hottest first
+    std::vector<std::pair<uint32_t, function_counts>> sorted{functions.begin(), functions.end()};
+    std::sort(sorted.begin(), sorted.end(), [](const auto & lhs, const auto & rhs) {
+        return lhs.second.inclusive > rhs.second.inclusive;
+    });
+
+    auto name_of = [this](uint32_t index) -> const std::string & {
+        static const std::string unknown = "?";
+        auto symbol = symbols.find(text->address_of(text->begin() + index));
+        return symbol == symbols.end() ? unknown : symbol->second;
+    };
+
+    first = true;
+    for (auto & [index, counts] : sorted) {
+        output << (first ? "\n" : ",\n") << "    {\"name\": \"" << name_of(index)
+               << "\", \"address\": " << text->address_of(text->begin() + index)
+               << ", \"calls\": " << counts.calls
+               << ", \"inclusive_instructions\": " << counts.inclusive << '}';
+        first = false;
+    }
+    // What arturo_c --layout-profile uses to put callers and callees together
+    output << "\n  ],\n  \"call_edges\": [";
+    first = true;
+    for (auto & [edge, calls] : edges) {
+        output << (first ? "\n" : ",\n") << "    {\"caller\": \"" << name_of(edge.first)
+               << "\", \"callee\": \"" << name_of(edge.second) << "\", \"calls\": " << calls
+               << '}';
+        first = false;
+    }
+    output << "\n  ]\n}" << std::endl;
+}
+
+} // namespace vm
@@ -0,0 +1,107 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "isa.h"
+#include "loader/decoded_text.h"
+#include "loader/image.h"
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vm {
+
+// Execution counters gathered by the profiled dispatch loops.
+class profile final {
+  public:
+    profile(const image &, const decoded_text &);
+
+    void count(isa::opcode op, uint64_t times = 1) {
+        opcode_counts[static_cast<uint8_t>(op)] += times;
+        instructions += times;
+    }
+
+    // A superinstruction, counted as the instructions it replaces except for a final jal
+    void count(const fused_sequence & seq) {
+        count(isa::opcode::sw, seq.stores);
+        count(isa::opcode::ori, seq.moves);
+        count(isa::opcode::lw, seq.loads);
+        fused += seq.length;
+        ++superinstructions;
+    }
+
+    // Calls into the function starting at index
+    void enter(uint32_t index) {
+        count_edge(index);
+        push(index);
+    }
+
+    // A jump without a link leaves the running function for another one, which then returns
+    // to its caller
+    void jump(uint32_t index) {
+        count_edge(index);
+        leave();
+        push(index);
+    }
+
+    // Returns from the innermost function
+    void leave() {
+        if (stack.empty()) return;
+        functions[stack.back().function].inclusive += instructions - stack.back().entered_at;
+        stack.pop_back();
+    }
+
+    // Returns from every function still running, as the guest has exited
+    void finish() {
+        while (not stack.empty()) leave();
+    }
+
+    [[nodiscard]] uint64_t instruction_count() const noexcept { return instructions; }
+    // Trips through the dispatch loop, each superinstruction being a single one
+    [[nodiscard]] uint64_t dispatch_count() const noexcept {
+        return instructions - fused + superinstructions;
+    }
+
+    void write_json(std::ostream &) const;
+
+  private:
+    void push(uint32_t index) {
+        ++functions[index].calls;
+        stack.push_back({index, instructions});
+    }
+    void count_edge(uint32_t callee) {
+        if (not stack.empty()) ++edges[{stack.back().function, callee}];
+    }
+
+    struct function_counts {
+        uint64_t calls = 0;
+        // Instructions executed while the function was on the stack, counted once per frame
+        uint64_t inclusive = 0;
+    };
+    struct frame {
+        uint32_t function;
+        uint64_t entered_at;
+    };
+
+    const decoded_text * text;
+    std::map<uint32_t, std::string> symbols;
+
+    std::array<uint64_t, isa::opcode_count> opcode_counts{};
+    uint64_t instructions = 0;
+    // Instructions covered by superinstructions, and how many of those ran
+    uint64_t fused = 0;
+    uint64_t superinstructions = 0;
+    std::unordered_map<uint32_t, function_counts> functions;
+    // Calls from each caller to each callee, by the functions' indices
+    std::map<std::pair<uint32_t, uint32_t>, uint64_t> edges;
+    std::vector<frame> stack;
+};
+
+} // namespace vm
+
+#endif
@@ -0,0 +1,48 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace vm {
+
+thread_pool::thread_pool(unsigned workers) {
+    if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+    this->workers.reserve(workers);
+    for (auto i = 0u; i < workers; ++i) this->workers.emplace_back([this] { work(); });
+}
+
+thread_pool::~thread_pool() noexcept {
+    {
+        std::lock_guard guard{lock};
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for (auto & worker : workers) worker.join();
+}
+
+std::future<void> thread_pool::submit(std::function<void()> job) {
+    std::packaged_task<void()> task{std::move(job)};
+    auto result = task.get_future();
+    {
+        std::lock_guard guard{lock};
+        jobs.push_back(std::move(task));
+    }
+    job_ready.notify_one();
+    return result;
+}
+
+void thread_pool::work() {
+    while (true) {
+        std::packaged_task<void()> job;
+        {
+            std::unique_lock guard{lock};
+            job_ready.wait(guard, [this] { return stopping or not jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+} // namespace vm
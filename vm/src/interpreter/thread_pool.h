@@ -0,0 +1,45 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vm {
+
+// A fixed set of worker threads running queued jobs in submission order.
+class thread_pool final {
+  public:
+    // Zero workers means one per hardware thread
+    explicit thread_pool(unsigned workers = 0);
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool & operator=(const thread_pool &) = delete;
+
+    thread_pool(thread_pool &&) = delete;
+    thread_pool & operator=(thread_pool &&) = delete;
+
+    // Finishes the queued jobs before joining the workers
+    ~thread_pool() noexcept;
+
+    // The future holds whatever the job throws, so the submitting thread can deal with it.
+    // Workers never let an exception escape.
+    [[nodiscard]] std::future<void> submit(std::function<void()> job);
+
+  private:
+    void work();
+
+    std::vector<std::thread> workers;
+    std::deque<std::packaged_task<void()>> jobs;
+    std::mutex lock;
+    std::condition_variable job_ready;
+    bool stopping = false;
+};
+
+} // namespace vm
+
+#endif
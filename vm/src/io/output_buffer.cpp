@@ -0,0 +1,105 @@
+#include "output_buffer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace vm {
+
+namespace {
+constexpr size_t buffered_size = 64 * 1024;
+constexpr size_t vectored_chunk_size = 8 * 1024;
+constexpr size_t vectored_chunk_count = 16;
+static_assert(vectored_chunk_count <= IOV_MAX);
+} // namespace
+
+output_buffer::output_buffer(int fd, mode buffering)
+    : fd{fd}
+    , buffering{buffering}
+    , chunk_size{buffering == mode::vectored ? vectored_chunk_size : buffered_size} {
+
+    auto chunk_count = 0u;
+    switch (buffering) {
+    case mode::unbuffered:
+        break;
+    case mode::buffered:
+        chunk_count = 1;
+        break;
+    case mode::vectored:
+        chunk_count = vectored_chunk_count;
+        break;
+    }
+    for (auto i = 0u; i < chunk_count; ++i) chunks.push_back(std::make_unique<char[]>(chunk_size));
+}
+
+void output_buffer::append(const char * text, size_t length) {
+    if (buffering == mode::unbuffered) {
+        write_all(text, length);
+        return;
+    }
+
+    while (length > 0) {
+        if (used == chunk_size) next_chunk();
+        auto count = std::min(length, chunk_size - used);
+        memcpy(chunks[current].get() + used, text, count);
+        used += count;
+        text += count;
+        length -= count;
+    }
+}
+
+void output_buffer::flush() {
+    // Moved from buffers have no chunks
+    if (chunks.empty() or (current == 0 and used == 0)) return;
+
+    if (buffering == mode::vectored) {
+        iovec pending[vectored_chunk_count];
+        size_t total = 0;
+        for (auto i = 0u; i <= current; ++i) {
+            pending[i] = {chunks[i].get(), i == current ? used : chunk_size};
+            total += pending[i].iov_len;
+        }
+        auto written = writev(fd, pending, static_cast<int>(current + 1));
+        auto done = written < 0 ? 0 : static_cast<size_t>(written);
+        // Finish a short write chunk by chunk
+        for (auto i = 0u; i <= current and done < total; ++i) {
+            if (done >= pending[i].iov_len) {
+                done -= pending[i].iov_len;
+                continue;
+            }
+            write_all(chunks[i].get() + done, pending[i].iov_len - done);
+            done = 0;
+        }
+    } else {
+        write_all(chunks.front().get(), used);
+    }
+
+    current = 0;
+    used = 0;
+}
+
+void output_buffer::next_chunk() {
+    if (current + 1 == chunks.size()) {
+        flush();
+    } else {
+        ++current;
+        used = 0;
+    }
+}
+
+void output_buffer::write_all(const char * text, size_t length) {
+    while (length > 0) {
+        auto written = write(fd, text, length);
+        if (written < 0) {
+            perror("Writing guest output");
+            return;
+        }
+        text += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
+} // namespace vm
@@ -0,0 +1,50 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace vm {
+
+// Coalesces guest console output into as few write calls as possible.
+class output_buffer final {
+  public:
+    enum class mode {
+        // One write per print, for comparison
+        unbuffered,
+        // One contiguous buffer, written when full
+        buffered,
+        // Several chunks, all written by a single writev when the last one fills
+        vectored,
+    };
+
+    output_buffer(int fd, mode);
+
+    output_buffer(const output_buffer &) = delete;
+    output_buffer & operator=(const output_buffer &) = delete;
+
+    output_buffer(output_buffer &&) noexcept = default;
+    output_buffer & operator=(output_buffer &&) noexcept = default;
+
+    ~output_buffer() noexcept { flush(); }
+
+    void append(const char * text, size_t length);
+    void flush();
+
+  private:
+    void next_chunk();
+    void write_all(const char * text, size_t length);
+
+    int fd;
+    mode buffering;
+    size_t chunk_size;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    // Position of the next byte
+    size_t current = 0;
+    size_t used = 0;
+};
+
+} // namespace vm
+
+#endif
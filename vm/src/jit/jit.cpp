@@ -0,0 +1,216 @@
+#include "jit.h"
+
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+#include <sys/mman.h>
+#include <utility>
+
+namespace vm {
+
+namespace {
+
+// The first fault raised while native code runs. Native frames can't be unwound, so it is only
+// thrown once the code returns. The code finishes its straight-line run first, which does
+// nothing outside the guest the fault is about to stop.
+thread_local std::exception_ptr native_fault;
+
+uint32_t load_word(memory * mem, uint32_t addr) noexcept {
+    try {
+        return mem->load_word(addr);
+    } catch (...) {
+        if (native_fault == nullptr) native_fault = std::current_exception();
+        return 0;
+    }
+}
+
+void store_word(memory * mem, uint32_t addr, uint32_t value) noexcept {
+    try {
+        mem->store_word(addr, value);
+    } catch (...) {
+        if (native_fault == nullptr) native_fault = std::current_exception();
+    }
+}
+
+// Emits x86-64 for guest instructions.
+// rbx holds the guest register file and r12 the guest memory, both callee saved.
+class emitter final {
+  public:
+    void prologue() {
+        // push rbx; push r12; push r13 (keeps the stack 16 byte aligned for calls)
+        bytes({0x53, 0x41, 0x54, 0x41, 0x55});
+        // mov rbx, rdi; mov r12, rsi
+        bytes({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4});
+    }
+
+    void epilogue(uint32_t next_index) {
+        // mov eax, next_index
+        bytes({0xB8});
+        imm32(next_index);
+        // pop r13; pop r12; pop rbx; ret
+        bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+    }
+
+    void ori(isa::reg rd, isa::reg rs, uint32_t imm) {
+        if (rd == isa::zero) return;
+        // mov eax, [rbx + rs]; or eax, imm; mov [rbx + rd], eax
+        bytes({0x8B, 0x43, slot(rs), 0x0D});
+        imm32(imm);
+        bytes({0x89, 0x43, slot(rd)});
+    }
+
+    void lui(isa::reg rd, uint32_t imm) {
+        if (rd == isa::zero) return;
+        // mov dword [rbx + rd], imm
+        bytes({0xC7, 0x43, slot(rd)});
+        imm32(imm);
+    }
+
+    void lw(isa::reg rd, isa::reg rs, uint32_t imm) {
+        address_argument(rs, imm);
+        call(reinterpret_cast<uint64_t>(&load_word));
+        // mov [rbx + rd], eax
+        if (rd != isa::zero) bytes({0x89, 0x43, slot(rd)});
+    }
+
+    void sw(isa::reg rd, isa::reg rs, uint32_t imm) {
+        address_argument(rs, imm);
+        // mov edx, [rbx + rd]
+        bytes({0x8B, 0x53, slot(rd)});
+        call(reinterpret_cast<uint64_t>(&store_word));
+    }
+
+    [[nodiscard]] const std::vector<uint8_t> & code() const noexcept { return output; }
+
+  private:
+    [[nodiscard]] static uint8_t slot(isa::reg reg) {
+        return static_cast<uint8_t>(reg * sizeof(uint32_t));
+    }
+
+    void address_argument(isa::reg rs, uint32_t imm) {
+        // mov esi, [rbx + rs]; add esi, imm
+        bytes({0x8B, 0x73, slot(rs), 0x81, 0xC6});
+        imm32(imm);
+    }
+
+    void call(uint64_t target) {
+        // mov rdi, r12; mov rax, target; call rax
+        bytes({0x4C, 0x89, 0xE7, 0x48, 0xB8});
+        for (auto i = 0u; i < 8; ++i) output.push_back(static_cast<uint8_t>(target >> (8 * i)));
+        bytes({0xFF, 0xD0});
+    }
+
+    void bytes(std::initializer_list<uint8_t> values) {
+        output.insert(output.end(), values.begin(), values.end());
+    }
+
+    void imm32(uint32_t value) {
+        for (auto i = 0u; i < 4; ++i) output.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    std::vector<uint8_t> output;
+};
+
+} // namespace
+
+jit::jit(const decoded_text & text, uint32_t threshold)
+    : text{&text}
+    , threshold{threshold} {}
+
+bool jit::supported() noexcept {
+#if defined(__x86_64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t jit::run(native_code code, uint32_t * registers, memory * mem) {
+    auto next = code(registers, mem);
+    if (native_fault != nullptr) std::rethrow_exception(std::exchange(native_fault, nullptr));
+    return next;
+}
+
+void jit::compile(function_state & func, uint32_t index) {
+    emitter emit;
+    emit.prologue();
+
+    // Translate until the first instruction that leaves straight-line code
+    const auto start = index;
+    auto straight_line = true;
+    while (straight_line) {
+        const auto & inst = text->begin()[index];
+        switch (inst.kind) {
+        case handler::ori:
+            emit.ori(inst.rd, inst.rs1, inst.imm);
+            ++index;
+            break;
+        case handler::lui:
+            emit.lui(inst.rd, inst.imm);
+            ++index;
+            break;
+        case handler::lw:
+            emit.lw(inst.rd, inst.rs1, inst.imm);
+            ++index;
+            break;
+        case handler::sw:
+            emit.sw(inst.rd, inst.rs1, inst.imm);
+            ++index;
+            break;
+        case handler::multi_store:
+        case handler::multi_move:
+        case handler::multi_load:
+        case handler::call_with_spill: {
+            const auto & seq = text->sequence(inst);
+            const auto * step = text->steps_of(seq);
+            for (auto i = 0u; i < seq.stores; ++i, ++step) emit.sw(step->rd, step->rs, step->imm);
+            for (auto i = 0u; i < seq.moves; ++i, ++step) emit.ori(step->rd, step->rs, step->imm);
+            for (auto i = 0u; i < seq.loads; ++i, ++step) emit.lw(step->rd, step->rs, step->imm);
+            index += seq.length;
+            // Leave the jal itself to the interpreter
+            if (inst.kind == handler::call_with_spill) {
+                --index;
+                straight_line = false;
+            }
+        } break;
+        default:
+            straight_line = false;
+        }
+    }
+
+    // Nothing to gain when the function starts with a control transfer
+    if (index == start) {
+        func.failed = true;
+        return;
+    }
+
+    emit.epilogue(index);
+    auto block = std::make_unique<code_block>(emit.code());
+    if (block->address() == nullptr) {
+        func.failed = true;
+        return;
+    }
+    func.code = reinterpret_cast<native_code>(block->address());
+    blocks.push_back(std::move(block));
+}
+
+jit::code_block::code_block(const std::vector<uint8_t> & code)
+    : mapping{nullptr}
+    , length{code.size()} {
+    auto * writable
+        = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (writable == MAP_FAILED) return;
+    memcpy(writable, code.data(), length);
+    // Never writable and executable at the same time
+    if (mprotect(writable, length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(writable, length);
+        return;
+    }
+    mapping = writable;
+}
+
+jit::code_block::~code_block() noexcept {
+    if (mapping != nullptr) munmap(mapping, length);
+}
+
+} // namespace vm
@@ -0,0 +1,94 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "loader/decoded_text.h"
+#include "memory/memory.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace vm {
+
+enum class tier {
+    // Never compile
+    interpret_only,
+    // Compile functions once they have been entered jit_threshold times
+    tiered,
+    // Compile every function on its first entry
+    jit_only,
+};
+
+// Translates the straight-line start of hot guest functions into x86-64.
+// Guest registers live in the machine's register file, lw and sw call back into memory.
+class jit final {
+  public:
+    // Runs native code, returning the index of the instruction to interpret next
+    using native_code = uint32_t (*)(uint32_t * registers, memory * mem);
+
+    static constexpr uint32_t default_threshold = 64;
+
+    jit(const decoded_text &, uint32_t threshold);
+
+    jit(const jit &) = delete;
+    jit & operator=(const jit &) = delete;
+
+    jit(jit &&) noexcept = default;
+    jit & operator=(jit &&) noexcept = default;
+
+    ~jit() noexcept = default;
+
+    // Whether native code can be generated on this host
+    [[nodiscard]] static bool supported() noexcept;
+
+    // Counts an entry to the function starting at index, compiling it once it is hot.
+    // Returns its native code, or null if it should be interpreted.
+    [[nodiscard]] native_code enter(uint32_t index) {
+        auto & func = functions[index];
+        if (func.code == nullptr and not func.failed and ++func.entries >= threshold)
+            compile(func, index);
+        return func.code;
+    }
+
+    // Runs native code, throwing any guest_error memory raised while it ran
+    [[nodiscard]] static uint32_t run(native_code, uint32_t * registers, memory *);
+
+    [[nodiscard]] size_t compiled_count() const noexcept { return blocks.size(); }
+
+  private:
+    struct function_state {
+        uint32_t entries = 0;
+        bool failed = false;
+        native_code code = nullptr;
+    };
+
+    // Executable memory holding one compiled function
+    class code_block final {
+      public:
+        explicit code_block(const std::vector<uint8_t> & code);
+
+        code_block(const code_block &) = delete;
+        code_block & operator=(const code_block &) = delete;
+
+        ~code_block() noexcept;
+
+        [[nodiscard]] void * address() const noexcept { return mapping; }
+
+      private:
+        void * mapping;
+        size_t length;
+    };
+
+    void compile(function_state &, uint32_t index);
+
+    const decoded_text * text;
+    uint32_t threshold;
+    std::unordered_map<uint32_t, function_state> functions;
+    std::vector<std::unique_ptr<code_block>> blocks;
+};
+
+} // namespace vm
+
+#endif
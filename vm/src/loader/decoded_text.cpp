@@ -0,0 +1,131 @@
+#include "decoded_text.h"
+
+#include "fault.h"
+
+namespace vm {
+
+using isa::opcode;
+
+decoded_text::decoded_text(const image & program, const void * const * labels, bool fuse)
+    : handler_labels{labels} {
+    auto start_time = std::chrono::steady_clock::now();
+
+    const auto * text_segment = program.find_segment(".text");
+    if (text_segment == nullptr) guest_fault("program has no .text segment", 0);
+    text_start = text_segment->vm_addr;
+    instruction_count = text_segment->length / static_cast<uint32_t>(sizeof(uint32_t));
+
+    code.reserve(instruction_count + 1);
+    for (auto i = 0u; i < instruction_count; ++i)
+        code.push_back(decode(text_segment->words[i], i));
+    code.push_back({nullptr, 0, handler::end_of_text, isa::zero, isa::zero, isa::zero});
+
+    if (fuse) fuse_sequences();
+
+    if (labels != nullptr)
+        for (auto & inst : code) inst.label = labels[static_cast<uint8_t>(inst.kind)];
+
+    elapsed = std::chrono::steady_clock::now() - start_time;
+}
+
+decoded_instruction decoded_text::decode(uint32_t word, uint32_t index) const {
+    decoded_instruction inst{nullptr,           0, handler::illegal, isa::decode_rd(word),
+                             isa::decode_rs1(word), isa::decode_rs2(word)};
+    switch (isa::decode_opcode(word)) {
+    case opcode::r_type:
+        inst.kind = handler::r_type;
+        inst.imm = isa::decode_func(word) | ((word >> isa::shamt_shift) & isa::reg_mask) << 8;
+        break;
+    case opcode::lui:
+        inst.kind = handler::lui;
+        inst.imm = static_cast<uint32_t>(isa::decode_imm(word)) << 16;
+        break;
+    case opcode::ori:
+        inst.kind = handler::ori;
+        inst.imm = isa::decode_imm(word);
+        break;
+    case opcode::lw:
+        inst.kind = handler::lw;
+        inst.imm = static_cast<uint32_t>(static_cast<int16_t>(isa::decode_imm(word)));
+        break;
+    case opcode::sw:
+        inst.kind = handler::sw;
+        inst.imm = static_cast<uint32_t>(static_cast<int16_t>(isa::decode_imm(word)));
+        break;
+    case opcode::jal:
+        inst.kind = handler::jal;
+        inst.imm = index_of(isa::decode_jump_target(word));
+        break;
+    case opcode::jr:
+        inst.kind = handler::jr;
+        break;
+    case opcode::beq: {
+        inst.kind = handler::beq;
+        // Branching out of .text lands on the sentinel after it
+        auto target = int64_t{index} + 1 + static_cast<int16_t>(isa::decode_imm(word));
+        inst.imm = target < 0 or target > instruction_count ? instruction_count
+                                                            : static_cast<uint32_t>(target);
+    } break;
+    case opcode::syscall:
+        inst.kind = handler::syscall;
+        inst.imm = isa::decode_func(word) | static_cast<uint32_t>(isa::decode_rs3(word)) << 8;
+        break;
+    }
+    return inst;
+}
+
+void decoded_text::fuse_sequences() {
+    for (auto index = 0u; index < instruction_count;) index += fuse_at(index);
+}
+
+// Turns the run starting at index into a superinstruction when there is one worth making.
+// Returns how many instructions were consumed.
+uint32_t decoded_text::fuse_at(uint32_t index) {
+    auto run_of = [this](uint32_t from, handler kind) {
+        auto end = from;
+        while (end < instruction_count and code[end].kind == kind and end - from < UINT8_MAX)
+            ++end;
+        return end - from;
+    };
+
+    // The backend lowers a call to spills, argument moves, a jal, then reloads
+    auto stores = run_of(index, handler::sw);
+    auto moves = run_of(index + stores, handler::ori);
+    auto loads = 0u;
+    const auto after = index + stores + moves;
+
+    fused_sequence seq{static_cast<uint32_t>(steps.size()), 0, 0, 0, 0, 0, isa::zero};
+    handler kind;
+    if (stores + moves > 0 and code[after].kind == handler::jal) {
+        kind = handler::call_with_spill;
+        seq.length = stores + moves + 1;
+        seq.call_target = code[after].imm;
+        seq.link = code[after].rd;
+    } else if (stores >= 2) {
+        kind = handler::multi_store;
+        moves = 0;
+        seq.length = stores;
+    } else if (stores == 0 and moves >= 2) {
+        kind = handler::multi_move;
+        seq.length = moves;
+    } else if (stores == 0 and moves == 0 and (loads = run_of(index, handler::lw)) >= 2) {
+        kind = handler::multi_load;
+        seq.length = loads;
+    } else {
+        return 1;
+    }
+
+    seq.stores = static_cast<uint8_t>(stores);
+    seq.moves = static_cast<uint8_t>(moves);
+    seq.loads = static_cast<uint8_t>(loads);
+    for (auto i = index; i < index + stores + moves + loads; ++i)
+        steps.push_back({code[i].imm, code[i].rd, code[i].rs1});
+
+    // Only the first instruction is replaced, the rest remain valid jump targets
+    code[index].kind = kind;
+    code[index].imm = static_cast<uint32_t>(sequences.size());
+    sequences.push_back(seq);
+    return seq.length;
+}
+
+} // namespace vm
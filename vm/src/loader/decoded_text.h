@@ -0,0 +1,133 @@
+#ifndef DECODED_TEXT_H
+#define DECODED_TEXT_H
+
+#include "image.h"
+#include "isa.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace vm {
+
+// What a decoded instruction does, one per interpreter handler.
+enum class handler : uint8_t {
+    r_type,
+    lui,
+    ori,
+    lw,
+    sw,
+    jal,
+    jr,
+    beq,
+    syscall,
+    illegal,
+    // Superinstructions, see fused_sequence
+    multi_store,
+    multi_move,
+    multi_load,
+    call_with_spill,
+    // Placed after the last instruction, so running off the end of .text faults
+    end_of_text,
+    count,
+};
+
+// A pre-split instruction, so the hot loop does no bit fiddling.
+struct alignas(16) decoded_instruction {
+    // The threaded loop's label for kind, or null when decoded for the switch loop
+    const void * label;
+    // lui: already shifted, ori: zero extended, lw/sw: sign extended,
+    // jal and beq: index of the target in the decoded text,
+    // syscall: func | rs3 << 8, r_type: func | shamt << 8,
+    // superinstructions: index of their fused_sequence
+    uint32_t imm;
+    handler kind;
+    isa::reg rd;
+    isa::reg rs1;
+    isa::reg rs2;
+};
+
+static_assert(sizeof(decoded_instruction) == 16);
+
+// One sw, ori or lw within a superinstruction, with its immediate decoded as usual
+struct fused_step {
+    uint32_t imm;
+    isa::reg rd;
+    isa::reg rs;
+};
+
+// A run of instructions executed by a single dispatch: its stores, then its moves, then its
+// loads, then for call_with_spill the jal ending the run.
+// The instructions it covers stay decoded, so jumping into the middle of a run still works.
+struct fused_sequence {
+    uint32_t first_step;
+    // Instructions covered, including the jal
+    uint32_t length;
+    uint32_t call_target;
+    uint8_t stores;
+    uint8_t moves;
+    uint8_t loads;
+    isa::reg link;
+};
+
+// The .text segment of a program, decoded once at load time.
+class decoded_text final {
+  public:
+    // labels is indexed by handler, or null when decoding for the switch loop.
+    // When fuse is set, the sequences the backend emits around calls become superinstructions.
+    decoded_text(const image &, const void * const * labels, bool fuse = true);
+
+    decoded_text(const decoded_text &) = delete;
+    decoded_text & operator=(const decoded_text &) = delete;
+
+    decoded_text(decoded_text &&) noexcept = default;
+    decoded_text & operator=(decoded_text &&) noexcept = default;
+
+    ~decoded_text() noexcept = default;
+
+    [[nodiscard]] const decoded_instruction * begin() const noexcept { return code.data(); }
+    // Number of instructions, not counting the end_of_text sentinel
+    [[nodiscard]] uint32_t size() const noexcept { return instruction_count; }
+    [[nodiscard]] uint32_t start() const noexcept { return text_start; }
+    // The labels this was decoded for
+    [[nodiscard]] const void * const * labels() const noexcept { return handler_labels; }
+
+    [[nodiscard]] const fused_sequence & sequence(const decoded_instruction & inst) const {
+        return sequences[inst.imm];
+    }
+    [[nodiscard]] const fused_step * steps_of(const fused_sequence & seq) const {
+        return steps.data() + seq.first_step;
+    }
+    [[nodiscard]] size_t superinstruction_count() const noexcept { return sequences.size(); }
+
+    // Index of the instruction at a guest address, or size() if outside of .text
+    [[nodiscard]] uint32_t index_of(uint32_t addr) const noexcept {
+        auto offset = addr - text_start;
+        if (offset % sizeof(uint32_t) != 0 or offset / sizeof(uint32_t) >= instruction_count)
+            return instruction_count;
+        return offset / static_cast<uint32_t>(sizeof(uint32_t));
+    }
+    [[nodiscard]] uint32_t address_of(const decoded_instruction * inst) const noexcept {
+        return text_start + static_cast<uint32_t>(inst - code.data()) * 4;
+    }
+
+    [[nodiscard]] std::chrono::nanoseconds decode_time() const noexcept { return elapsed; }
+
+  private:
+    // index is where the instruction is in the text, branches are relative to it
+    [[nodiscard]] decoded_instruction decode(uint32_t word, uint32_t index) const;
+    void fuse_sequences();
+    [[nodiscard]] uint32_t fuse_at(uint32_t index);
+
+    std::vector<decoded_instruction> code;
+    std::vector<fused_sequence> sequences;
+    std::vector<fused_step> steps;
+    const void * const * handler_labels;
+    uint32_t text_start;
+    uint32_t instruction_count;
+    std::chrono::nanoseconds elapsed;
+};
+
+} // namespace vm
+
+#endif
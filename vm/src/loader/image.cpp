@@ -0,0 +1,152 @@
+#include "image.h"
+
+#include "isa.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vm {
+
+namespace {
+// Reads a name packed most significant byte first and NUL padded to a whole word
+std::string unpack_name(const uint32_t * words, size_t & word, size_t end) {
+    std::string name;
+    bool terminated = false;
+    while (not terminated and word < end) {
+        auto packed = words[word++];
+        for (auto shift = 24; shift >= 0; shift -= 8) {
+            auto c = static_cast<char>((packed >> shift) & 0xFF);
+            if (c == '\0') {
+                terminated = true;
+                break;
+            }
+            name.push_back(c);
+        }
+    }
+    return name;
+}
+} // namespace
+
+image image::load(const std::string & path, load_mode mode) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    auto file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        perror("Opening program");
+        exit(1);
+    }
+
+    struct stat file_stat {};
+    if (fstat(file, &file_stat) != 0) {
+        perror("Reading program");
+        exit(1);
+    }
+    auto file_size = static_cast<size_t>(file_stat.st_size);
+
+    if (file_size < isa::header_size or file_size % sizeof(uint32_t) != 0) {
+        std::cout << path << " is not a compiled program." << std::endl;
+        exit(2);
+    }
+
+    image result;
+    const uint32_t * words = nullptr;
+    switch (mode) {
+    case load_mode::mapped: {
+        auto * mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped == MAP_FAILED) {
+            perror("Mapping program");
+            exit(2);
+        }
+        result.mapping = {mapped, unmapper{file_size}};
+        words = static_cast<const uint32_t *>(mapped);
+    } break;
+    case load_mode::eager: {
+        result.contents.resize(file_size / sizeof(uint32_t));
+        auto * dest = reinterpret_cast<char *>(result.contents.data());
+        for (size_t done = 0; done < file_size;) {
+            auto count = read(file, dest + done, file_size - done);
+            if (count <= 0) {
+                std::cout << "Error occured reading " << path << std::endl;
+                exit(2);
+            }
+            done += static_cast<size_t>(count);
+        }
+        words = result.contents.data();
+    } break;
+    }
+    close(file);
+
+    result.parse(words, file_size / sizeof(uint32_t));
+    result.elapsed = std::chrono::steady_clock::now() - start_time;
+    return result;
+}
+
+void image::parse(const uint32_t * words, size_t word_count) {
+
+    if (memcmp(words, isa::magic_bytes, sizeof(isa::magic_bytes)) != 0) {
+        std::cout << "Bad magic bytes, not a compiled program." << std::endl;
+        exit(2);
+    }
+
+    static constexpr auto header_words = sizeof(isa::magic_bytes) / sizeof(uint32_t);
+    entry = words[header_words];
+    stack_start = words[header_words + 1];
+    auto table_words = words[header_words + 2] / sizeof(uint32_t);
+
+    auto word = header_words + 3;
+    const auto table_end = word + table_words;
+    const auto file_bytes = word_count * sizeof(uint32_t);
+    if (table_end > word_count) {
+        std::cout << "Segment table runs past the end of the file." << std::endl;
+        exit(2);
+    }
+
+    while (word < table_end) {
+        if (word + 3 >= table_end) {
+            std::cout << "Truncated segment table entry." << std::endl;
+            exit(2);
+        }
+        auto offset = words[word++];
+        auto length = words[word++];
+        auto vm_addr = words[word++];
+
+        auto name = unpack_name(words, word, table_end);
+
+        if (offset % sizeof(uint32_t) != 0 or length % sizeof(uint32_t) != 0
+            or offset > file_bytes or length > file_bytes - offset) {
+            std::cout << "Segment " << name << " is outside of the file." << std::endl;
+            exit(2);
+        }
+        segs.push_back({std::move(name), vm_addr, length, words + offset / sizeof(uint32_t)});
+    }
+}
+
+const segment * image::find_segment(const std::string & name) const {
+    for (auto & seg : segs)
+        if (seg.name == name) return &seg;
+    return nullptr;
+}
+
+std::map<uint32_t, std::string> image::symbols() const {
+    std::map<uint32_t, std::string> result;
+    const auto * table = find_segment(isa::symbol_table_segment);
+    if (table == nullptr) return result;
+
+    const auto end = table->length / sizeof(uint32_t);
+    for (size_t word = 0; word < end;) {
+        auto addr = table->words[word++];
+        result.emplace(addr, unpack_name(table->words, word, end));
+    }
+    return result;
+}
+
+void image::unmapper::operator()(void * mapped) const noexcept { munmap(mapped, length); }
+
+} // namespace vm
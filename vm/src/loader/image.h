@@ -0,0 +1,75 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+struct segment {
+    std::string name;
+    uint32_t vm_addr;
+    // Length in bytes
+    uint32_t length;
+    const uint32_t * words;
+};
+
+enum class load_mode {
+    // mmap the file read-only and point the segments straight at it
+    mapped,
+    // read the whole file into memory
+    eager,
+};
+
+// A compiled .bin file, as written by bytecode::modul::write.
+class image final {
+  public:
+    static image load(const std::string & path, load_mode = load_mode::mapped);
+
+    image(const image &) = delete;
+    image & operator=(const image &) = delete;
+
+    image(image &&) noexcept = default;
+    image & operator=(image &&) noexcept = default;
+
+    ~image() noexcept = default;
+
+    [[nodiscard]] uint32_t exec_start() const noexcept { return entry; }
+    [[nodiscard]] uint32_t sp_start() const noexcept { return stack_start; }
+    [[nodiscard]] const std::vector<segment> & segments() const noexcept { return segs; }
+
+    [[nodiscard]] const segment * find_segment(const std::string & name) const;
+
+    // Function names by address, from the symbol table segment if there is one
+    [[nodiscard]] std::map<uint32_t, std::string> symbols() const;
+
+    // Whether the segments point into a read-only mapping of the file
+    [[nodiscard]] bool zero_copy() const noexcept { return mapping != nullptr; }
+    [[nodiscard]] std::chrono::nanoseconds load_time() const noexcept { return elapsed; }
+
+  private:
+    image() = default;
+
+    void parse(const uint32_t * words, size_t word_count);
+
+    struct unmapper {
+        size_t length;
+        void operator()(void *) const noexcept;
+    };
+
+    std::vector<uint32_t> contents;
+    std::unique_ptr<void, unmapper> mapping{nullptr, unmapper{0}};
+    std::vector<segment> segs;
+    std::chrono::nanoseconds elapsed{};
+    uint32_t entry = 0;
+    uint32_t stack_start = 0;
+};
+
+} // namespace vm
+
+#endif
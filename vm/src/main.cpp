@@ -1,2 +1,214 @@
+#include "fault.h"
+#include "interpreter/machine.h"
+#include "interpreter/thread_pool.h"
+#include "loader/decoded_text.h"
+#include "loader/image.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <future>
 #include <iostream>
-int main() { std::cout << "Hello World" << std::endl; }
+#include <map>
+#include <string_view>
+#include <vector>
+
+namespace {
+void usage(const char * name) {
+    std::cout << "Usage: " << name << " [options] program.bin...\n"
+              << "  --switch      use the switch dispatch loop instead of threaded dispatch\n"
+              << "  --eager       read the whole program into memory instead of mapping it\n"
+              << "  --load-stats  report load and decode time and memory per instruction\n"
+              << "  --no-fuse     don't combine call sequences into superinstructions\n"
+              << "  --interpret   never compile guest functions to native code\n"
+              << "  --jit         compile guest functions on their first call rather than their "
+              << vm::jit::default_threshold << "th.\n"
+              << "                Only the loads, stores and moves a function starts with become\n"
+              << "                native code, the interpreter runs the rest. x86-64 only.\n"
+              << "  --unbuffered  write guest output on every print\n"
+              << "  --writev      buffer guest output in chunks written with one writev\n"
+              << "  --profile=F   write instruction and call counts to F as JSON, - for stderr\n"
+              << "  --copies=N    run N instances of every program\n"
+              << "  --threads=N   run instances on N worker threads, default one per core\n"
+              << "With several instances the exit code is the first non-zero one, in order."
+              << std::endl;
+}
+
+// Parses the N of --flag=N, which must be positive
+unsigned parse_count(std::string_view value, const char * name) {
+    unsigned count = 0;
+    for (auto c : value) {
+        if (c < '0' or c > '9' or count > 100'000) {
+            count = 0;
+            break;
+        }
+        count = count * 10 + static_cast<unsigned>(c - '0');
+    }
+    if (count == 0) {
+        std::cout << "Expected a positive count, not " << value << std::endl;
+        usage(name);
+        exit(1);
+    }
+    return count;
+}
+
+// Reports a guest that stopped on a fault, returning its exit code
+int report(const vm::guest_error & fault) {
+    std::cout << std::flush;
+    std::cerr << fault << std::endl;
+    return 3;
+}
+
+// A binary is loaded and decoded once, then shared by all of its instances
+struct shared_program {
+    vm::image program;
+    vm::decoded_text text;
+};
+
+void print_load_stats(const char * path, const shared_program & shared) {
+    const auto & [program, text] = shared;
+    std::cerr << "Loaded " << (program.zero_copy() ? "mapped " : "") << path << " in "
+              << program.load_time().count() / 1000 << " us" << std::endl;
+    auto count = text.size();
+    auto nanos = text.decode_time().count();
+    std::cerr << "Decoded " << count << " instructions in " << nanos << " ns ("
+              << (count == 0 ? 0 : nanos / count) << " ns each), "
+              << sizeof(vm::decoded_instruction) << " bytes each ("
+              << sizeof(vm::decoded_instruction) - sizeof(uint32_t) << " more than encoded), "
+              << text.superinstruction_count() << " superinstructions" << std::endl;
+}
+} // namespace
+
+// Faults while loading or running a single instance end up here, the thread pool hands the
+// faults of several instances back through their futures
+int main(const int arg_count, const char * const * const args) try {
+
+    auto mode = vm::dispatch::threaded;
+    auto load = vm::load_mode::mapped;
+    auto load_stats = false;
+    auto fuse = true;
+    vm::machine_options options;
+    options.execution = vm::tier::tiered;
+    std::vector<const char *> program_paths;
+    std::string_view profile_path;
+    auto copies = 1u;
+    auto threads = 0u;
+    for (auto i = 1; i < arg_count; ++i) {
+        std::string_view arg{args[i]};
+        if (arg == "--switch") {
+            mode = vm::dispatch::switched;
+        } else if (arg == "--eager") {
+            load = vm::load_mode::eager;
+        } else if (arg == "--load-stats") {
+            load_stats = true;
+        } else if (arg == "--no-fuse") {
+            fuse = false;
+        } else if (arg == "--interpret") {
+            options.execution = vm::tier::interpret_only;
+        } else if (arg == "--jit") {
+            options.execution = vm::tier::jit_only;
+        } else if (arg == "--unbuffered") {
+            options.output = vm::output_buffer::mode::unbuffered;
+        } else if (arg == "--writev") {
+            options.output = vm::output_buffer::mode::vectored;
+        } else if (arg.substr(0, 10) == "--profile=" and arg.size() > 10) {
+            profile_path = arg.substr(10);
+            options.profile = true;
+        } else if (arg.substr(0, 9) == "--copies=") {
+            copies = parse_count(arg.substr(9), args[0]);
+        } else if (arg.substr(0, 10) == "--threads=") {
+            threads = parse_count(arg.substr(10), args[0]);
+        } else if (arg.substr(0, 2) == "--") {
+            usage(args[0]);
+            exit(1);
+        } else {
+            program_paths.push_back(args[i]);
+        }
+    }
+
+    if (program_paths.empty()) {
+        usage(args[0]);
+        exit(1);
+    }
+    if (options.execution == vm::tier::jit_only) {
+        // Either would interpret everything, which isn't what --jit asked for
+        if (not vm::jit::supported()) {
+            std::cout << "--jit needs the x86-64 JIT, this build can only interpret" << std::endl;
+            exit(1);
+        }
+        if (options.profile) {
+            std::cout << "--profile interprets everything, so it can't be used with --jit"
+                      << std::endl;
+            exit(1);
+        }
+    }
+
+    // Load every distinct binary once
+    std::vector<shared_program> programs;
+    std::map<std::string_view, size_t> loaded;
+    std::vector<size_t> instances;
+    programs.reserve(program_paths.size());
+    for (const auto * path : program_paths) {
+        auto [found, inserted] = loaded.emplace(path, programs.size());
+        if (inserted) {
+            auto program = vm::image::load(path, load);
+            vm::decoded_text text{program, vm::machine::threaded_labels(options.profile), fuse};
+            programs.push_back({std::move(program), std::move(text)});
+            if (load_stats) print_load_stats(path, programs.back());
+        }
+        for (auto i = 0u; i < copies; ++i) instances.push_back(found->second);
+    }
+
+    if (instances.size() == 1) {
+        const auto & [program, text] = programs.front();
+        vm::machine machine{program, text, options};
+        auto exit_code = machine.run(mode);
+
+        if (options.profile) {
+            if (profile_path == "-") {
+                machine.execution_profile()->write_json(std::cerr);
+            } else {
+                std::ofstream profile_file{std::string{profile_path}};
+                if (not profile_file) {
+                    std::cout << "Could not open " << profile_path << std::endl;
+                    exit(1);
+                }
+                machine.execution_profile()->write_json(profile_file);
+            }
+        }
+        return exit_code;
+    }
+
+    if (options.profile) {
+        std::cout << "--profile only supports a single instance" << std::endl;
+        exit(1);
+    }
+
+    // Every instance has its own registers, memory and JIT, only the program is shared
+    std::vector<int> exit_codes(instances.size());
+    std::vector<std::future<void>> finished;
+    finished.reserve(instances.size());
+    {
+        vm::thread_pool pool{threads};
+        for (auto i = 0u; i < instances.size(); ++i) {
+            finished.push_back(pool.submit([&, i] {
+                const auto & [program, text] = programs[instances[i]];
+                vm::machine machine{program, text, options};
+                exit_codes[i] = machine.run(mode);
+            }));
+        }
+    }
+
+    // The workers are joined, so faults are reported and the VM exits from this thread alone
+    auto first_failure = 0;
+    for (auto i = 0u; i < instances.size(); ++i) {
+        try {
+            finished[i].get();
+        } catch (const vm::guest_error & fault) {
+            exit_codes[i] = report(fault);
+        }
+        if (first_failure == 0) first_failure = exit_codes[i];
+    }
+    return first_failure;
+} catch (const vm::guest_error & fault) {
+    return report(fault);
+}
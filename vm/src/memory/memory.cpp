@@ -0,0 +1,91 @@
+#include "memory.h"
+
+#include <algorithm>
+
+namespace vm {
+
+namespace {
+// Backs reads of pages that were never written
+const std::array<uint32_t, 1024> zero_page{};
+} // namespace
+
+void memory::map(uint32_t vm_addr, const uint32_t * words, uint32_t length, bool shared) {
+    if (vm_addr % sizeof(uint32_t) != 0) guest_fault("misaligned segment", vm_addr);
+
+    const auto word_count = length / static_cast<uint32_t>(sizeof(uint32_t));
+    auto i = 0u;
+    while (i < word_count) {
+        auto addr = vm_addr + i * static_cast<uint32_t>(sizeof(uint32_t));
+        auto in_page = std::min(page_words - word_in_page(addr), word_count - i);
+
+        if (shared and in_page == page_words) {
+            auto & entry = entry_for(addr);
+            entry.owned.reset();
+            entry.read = words + i;
+        } else {
+            // Partial pages can't be shared, as the rest of the page must read as zero
+            auto & target = writable_page(addr);
+            std::copy(words + i, words + i + in_page, target.begin() + word_in_page(addr));
+        }
+        i += in_page;
+    }
+
+    last_page = UINT32_MAX;
+}
+
+size_t memory::allocated_bytes() const noexcept {
+    size_t total = 0;
+    for (auto & tbl : directory) {
+        if (tbl == nullptr) continue;
+        total += sizeof(table);
+        for (auto & entry : *tbl)
+            if (entry.owned != nullptr) total += sizeof(page);
+    }
+    return total;
+}
+
+const memory::page_entry * memory::find_entry(uint32_t addr) const {
+    const auto & tbl = directory[addr >> (page_bits + table_bits)];
+    if (tbl == nullptr) return nullptr;
+    return &(*tbl)[(addr >> page_bits) & ((1u << table_bits) - 1)];
+}
+
+memory::page_entry & memory::entry_for(uint32_t addr) {
+    auto & tbl = directory[addr >> (page_bits + table_bits)];
+    if (tbl == nullptr) tbl = std::make_unique<table>();
+    return (*tbl)[(addr >> page_bits) & ((1u << table_bits) - 1)];
+}
+
+memory::page & memory::writable_page(uint32_t addr) {
+    auto & entry = entry_for(addr);
+    if (entry.owned == nullptr) {
+        // Copy on first write to a shared page, or zero fill a fresh one
+        entry.owned = std::make_unique<page>();
+        if (entry.read != nullptr)
+            std::copy(entry.read, entry.read + page_words, entry.owned->begin());
+        entry.read = entry.owned->data();
+    }
+    return *entry.owned;
+}
+
+void memory::translate(uint32_t addr) {
+    static_assert(sizeof(zero_page) == page_size);
+    const auto * entry = find_entry(addr);
+    last_page = addr >> page_bits;
+    if (entry == nullptr or entry->read == nullptr) {
+        last_read = zero_page.data();
+        last_write = nullptr;
+    } else {
+        last_read = entry->read;
+        last_write = entry->owned == nullptr ? nullptr : entry->owned->data();
+    }
+}
+
+void memory::translate_for_write(uint32_t addr) {
+    auto & target = writable_page(addr);
+    last_page = addr >> page_bits;
+    last_read = target.data();
+    last_write = target.data();
+}
+
+} // namespace vm
@@ -0,0 +1,91 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "fault.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+namespace vm {
+
+// Word addressed guest memory. Bytes within a word are ordered most significant first,
+// matching how the compiler packs the data segment.
+// Pages are found through a two level table and only allocated once written to,
+// so an instance only pays for the memory it touches.
+class memory final {
+  public:
+    memory() = default;
+
+    memory(const memory &) = delete;
+    memory & operator=(const memory &) = delete;
+
+    memory(memory &&) noexcept = default;
+    memory & operator=(memory &&) noexcept = default;
+
+    ~memory() noexcept = default;
+
+    // Makes length bytes of words visible at vm_addr.
+    // When shared, whole pages read straight from words until the guest first writes to them,
+    // so words must outlive this memory. Otherwise everything is copied.
+    void map(uint32_t vm_addr, const uint32_t * words, uint32_t length, bool shared);
+
+    [[nodiscard]] uint32_t load_word(uint32_t addr) {
+        if (addr % sizeof(uint32_t) != 0) guest_fault("misaligned load", addr);
+        if (addr >> page_bits != last_page) translate(addr);
+        return last_read[word_in_page(addr)];
+    }
+
+    void store_word(uint32_t addr, uint32_t value) {
+        if (addr % sizeof(uint32_t) != 0) guest_fault("misaligned store", addr);
+        if (addr >> page_bits != last_page or last_write == nullptr) translate_for_write(addr);
+        last_write[word_in_page(addr)] = value;
+    }
+
+    [[nodiscard]] uint8_t load_byte(uint32_t addr) {
+        auto word = load_word(addr & ~3u);
+        return static_cast<uint8_t>(word >> (24 - 8 * (addr & 3u)));
+    }
+
+    // Bytes allocated for page tables and private pages
+    [[nodiscard]] size_t allocated_bytes() const noexcept;
+
+  private:
+    static constexpr uint32_t page_bits = 12;
+    static constexpr uint32_t table_bits = 10;
+    static constexpr uint32_t directory_bits = 32 - page_bits - table_bits;
+
+    static constexpr uint32_t page_size = 1u << page_bits;
+    static constexpr uint32_t page_words = page_size / sizeof(uint32_t);
+    using page = std::array<uint32_t, page_words>;
+
+    struct page_entry {
+        // Either a shared view, the owned page, or null when never touched
+        const uint32_t * read = nullptr;
+        // Null until the page has a private copy
+        std::unique_ptr<page> owned;
+    };
+    using table = std::array<page_entry, 1u << table_bits>;
+
+    [[nodiscard]] static uint32_t word_in_page(uint32_t addr) {
+        return (addr & (page_size - 1)) / static_cast<uint32_t>(sizeof(uint32_t));
+    }
+
+    [[nodiscard]] const page_entry * find_entry(uint32_t addr) const;
+    [[nodiscard]] page_entry & entry_for(uint32_t addr);
+    [[nodiscard]] page & writable_page(uint32_t addr);
+
+    void translate(uint32_t addr);
+    void translate_for_write(uint32_t addr);
+
+    std::array<std::unique_ptr<table>, 1u << directory_bits> directory;
+
+    // One entry translation cache for the last page accessed
+    uint32_t last_page = UINT32_MAX;
+    const uint32_t * last_read = nullptr;
+    uint32_t * last_write = nullptr;
+};
+
+} // namespace vm
+
+#endif